@@ -0,0 +1,22 @@
+#include "Backoff.h"
+#include "Arduino.h"
+
+void Backoff::Failed(uint32_t now) {
+  attempts++;
+  failures++;
+  last_ms = now;
+  wait_ms = delay_ms / 2 + random(delay_ms / 2 + 1);
+  delay_ms = delay_ms < max_ms / 2 ? delay_ms * 2 : max_ms;
+}
+
+void Backoff::Succeeded(uint32_t now) {
+  attempts++;
+  last_ms = now;
+  wait_ms = 0;
+  delay_ms = min_ms;
+}
+
+void Backoff::Lost(uint32_t now) {
+  last_ms = now;
+  wait_ms = random(delay_ms + 1);
+}
@@ -0,0 +1,48 @@
+//////////////////////////////////////////////////////////
+//
+// Retry pacing with exponential backoff and jitter
+//
+// After every failed attempt the delay doubles up to a maximum; the next
+// attempt is due at a random point in the upper half of the delay, so a
+// fleet of desks that lost its broker at the same moment does not come back
+// in lockstep - nor right after losing it together. A success resets the
+// delay.
+//
+
+#ifndef BACKOFF_H
+#define BACKOFF_H
+
+#include <stdint.h>
+
+class Backoff
+{
+  uint32_t min_ms;
+  uint32_t max_ms;
+  uint32_t delay_ms;
+  uint32_t last_ms = 0;
+  uint32_t wait_ms = 0;  // from last_ms to the next attempt
+
+  public:
+
+  uint32_t attempts = 0;
+  uint32_t failures = 0;
+
+  Backoff(uint32_t min_ms, uint32_t max_ms) : min_ms(min_ms), max_ms(max_ms), delay_ms(min_ms) {}
+
+  // Is an attempt due? The first one always is.
+  bool Due(uint32_t now) { return now - last_ms >= wait_ms; }
+
+  // Record a failed attempt and schedule the next one
+  void Failed(uint32_t now);
+
+  // Record a successful attempt
+  void Succeeded(uint32_t now);
+
+  // The connection was lost: the first attempt is due within the minimum
+  // delay, spread out like the retries
+  void Lost(uint32_t now);
+
+  uint32_t Wait() { return wait_ms; }
+};
+
+#endif // BACKOFF_H
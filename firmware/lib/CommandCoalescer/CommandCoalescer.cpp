@@ -0,0 +1,33 @@
+#include "CommandCoalescer.h"
+
+void CommandCoalescer::Offer(uint8_t target) {
+  received++;
+  if (pending)
+    dropped++;
+  pending = target;
+}
+
+uint8_t CommandCoalescer::Take(uint32_t now, uint8_t height, int8_t direction, uint8_t active) {
+  if (!pending || (applied && now - last_apply < COALESCE_WINDOW_MS))
+    return 0;
+
+  uint8_t target = pending;
+  pending = 0;
+
+  if (direction && target == active) {
+    dropped++;
+    return 0;
+  }
+
+  // don't flip the motor for a few cm, stop where we are
+  int8_t wanted = target > height ? 1 : target < height ? -1 : 0;
+  int distance = target > height ? target - height : height - target;
+  if (direction && wanted == -direction && distance <= COALESCE_HYSTERESIS_CM) {
+    reversals++;
+    target = height;
+  }
+
+  applied = true;
+  last_apply = now;
+  return target;
+}
@@ -0,0 +1,48 @@
+//////////////////////////////////////////////////////////
+//
+// Coalescing of height targets from MQTT set messages
+//
+// A slider in a dashboard sends dozens of set messages per second. The
+// first target after a quiet period is passed on right away; targets that
+// arrive within COALESCE_WINDOW_MS of it only replace the pending one, so at
+// most one target per window reaches the motor and every replaced target is
+// counted as dropped. While the table moves, a target that would reverse it
+// by no more than COALESCE_HYSTERESIS_CM stops the table where it is instead.
+//
+
+#ifndef COMMAND_COALESCER_H
+#define COMMAND_COALESCER_H
+
+#include <stdint.h>
+
+#ifndef COALESCE_WINDOW_MS
+#define COALESCE_WINDOW_MS 250
+#endif
+#ifndef COALESCE_HYSTERESIS_CM
+#define COALESCE_HYSTERESIS_CM 2
+#endif
+
+class CommandCoalescer
+{
+  uint8_t pending = 0;      // 0: nothing pending
+  bool applied = false;     // last_apply is valid
+  uint32_t last_apply = 0;  // millis()
+
+  public:
+
+  uint32_t received = 0;
+  uint32_t dropped = 0;     // replaced before they were applied, or repeats of the active target
+  uint32_t reversals = 0;   // reversals inside the hysteresis band turned into a stop
+
+  // Queue a target; replaces one that is still pending
+  void Offer(uint8_t target);
+
+  // A target waits for the window to end
+  bool Pending() { return pending != 0; }
+
+  // Returns the target to apply now, or 0. height is the current height,
+  // direction 1 up, -1 down, 0 stopped and active the target being driven to, if any.
+  uint8_t Take(uint32_t now, uint8_t height, int8_t direction, uint8_t active);
+};
+
+#endif // COMMAND_COALESCER_H
@@ -0,0 +1,145 @@
+#include "CommandQueue.h"
+#include <string.h>
+#include <stdlib.h>
+#include <ctype.h>
+
+static bool is_id_char(char c) {
+  return isalnum((unsigned char)c) || c == '-' || c == '_' || c == '.';
+}
+
+// Compare the word at p (up to len chars) against w
+static bool word_is(const char * p, uint8_t len, const char * w) {
+  return strlen(w) == len && !strncmp(p, w, len);
+}
+
+const char * CommandQueue::SplitId(const char * text, char * id) {
+  id[0] = 0;
+  const char * p = text;
+  while (is_id_char(*p)) p++;
+  if (*p != ':' || p == text || p - text > QUEUE_ID_LEN)
+    return text;
+
+  memcpy(id, text, p - text);
+  id[p - text] = 0;
+  return p + 1;
+}
+
+const char * CommandQueue::Parse(const char * text, QueuedCommand & out) {
+  out.count = 0;
+  const char * p = text;
+
+  while (*p) {
+    while (*p == ' ' || *p == ';') p++;
+    if (!*p) break;
+
+    const char * end = p;
+    while (*end && *end != ';') end++;
+    const char * word_end = p;
+    while (word_end < end && *word_end != ' ') word_end++;
+    uint8_t len = word_end - p;
+
+    if (out.count == QUEUE_STEPS)
+      return "too many steps";
+    QueueStep & s = out.steps[out.count];
+
+    if (isdigit((unsigned char)*p)) {
+      long cm = atol(p);
+      if (cm > 255)
+        return "invalid height";
+      s.kind = STEP_MOVE;
+      s.value = cm;
+    } else if (word_is(p, len, "up") || word_is(p, len, "high")) {
+      s.kind = STEP_HIGH;
+    } else if (word_is(p, len, "down") || word_is(p, len, "low")) {
+      s.kind = STEP_LOW;
+    } else if (word_is(p, len, "stop")) {
+      s.kind = STEP_STOP;
+    } else if (word_is(p, len, "wait") && word_end < end && isdigit((unsigned char)word_end[1])) {
+      long seconds = atol(word_end + 1);
+      if (seconds > 65535)
+        return "wait too long";
+      s.kind = STEP_WAIT;
+      s.value = seconds;
+    } else {
+      return "unknown step";
+    }
+    out.count++;
+    p = end;
+  }
+
+  return out.count ? nullptr : "no steps";
+}
+
+void CommandQueue::event(const QueuedCommand & c, const char * name, const char * detail) {
+  if (hook && c.id[0])
+    hook(c.id, name, detail);
+}
+
+bool CommandQueue::Push(const QueuedCommand & c) {
+  if (used == QUEUE_DEPTH) {
+    event(c, "failed", "queue full");
+    return false;
+  }
+
+  q[(head + used) % QUEUE_DEPTH] = c;
+  used++;
+  event(c, "accepted", "");
+  return true;
+}
+
+bool CommandQueue::Push(const char * text) {
+  QueuedCommand c;
+  const char * error = Parse(SplitId(text, c.id), c);
+  if (error) {
+    event(c, "failed", error);
+    return false;
+  }
+  return Push(c);
+}
+
+bool CommandQueue::Replace(const char * text) {
+  QueuedCommand c;
+  const char * error = Parse(SplitId(text, c.id), c);
+  if (error) {
+    event(c, "failed", error);
+    return false;
+  }
+  Supersede();
+  return Push(c);
+}
+
+void CommandQueue::pop() {
+  head = (head + 1) % QUEUE_DEPTH;
+  used--;
+  step = 0;
+  started = false;
+}
+
+void CommandQueue::Supersede() {
+  while (used) {
+    event(q[head], "superseded", "");
+    pop();
+  }
+}
+
+void CommandQueue::Fail(const char * reason) {
+  if (!used)
+    return;
+  event(q[head], "failed", reason);
+  pop();
+  Supersede();
+}
+
+void CommandQueue::StepDone(const char * detail) {
+  if (!used)
+    return;
+  started = false;
+  if (++step < q[head].count)
+    return;
+  event(q[head], "completed", detail);
+  pop();
+}
+
+const QueueStep * CommandQueue::Current() {
+  return used ? &q[head].steps[step] : nullptr;
+}
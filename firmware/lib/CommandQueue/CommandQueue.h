@@ -0,0 +1,98 @@
+//////////////////////////////////////////////////////////
+//
+// Sequenced command queue
+//
+// Commands are runs of steps - move to a height, to the high/low target,
+// wait, stop - executed in order, one command after the other. A command may
+// carry an id; every state change of a command with an id is reported
+// through the event hook:
+//
+//   accepted    queued
+//   superseded  dropped for a newer direct command or a button press
+//   completed   its last step finished
+//   failed      rejected, or a step could not finish (detail says why)
+//
+// Text form: "[<id>:]<step>[;<step>...]" with steps "<cm>", "up"/"high",
+// "down"/"low", "stop" and "wait <s>", e.g. "42:110;wait 60;90".
+//
+// The queue only keeps track; the caller starts each step and reports back
+// with StepDone() or Fail().
+//
+
+#ifndef COMMAND_QUEUE_H
+#define COMMAND_QUEUE_H
+
+#include <stdint.h>
+
+#define QUEUE_DEPTH 4   // commands
+#define QUEUE_STEPS 8   // steps per command
+#define QUEUE_ID_LEN 15
+
+// STEP_WAIT_MS has no text form, it schedules the start of group moves
+enum StepKind : uint8_t { STEP_MOVE, STEP_HIGH, STEP_LOW, STEP_WAIT, STEP_STOP, STEP_WAIT_MS };
+
+struct QueueStep {
+  StepKind kind;
+  uint16_t value;  // cm for STEP_MOVE, seconds for STEP_WAIT, ms for STEP_WAIT_MS
+};
+
+struct QueuedCommand {
+  char id[QUEUE_ID_LEN + 1];  // empty: no events
+  QueueStep steps[QUEUE_STEPS];
+  uint8_t count;
+};
+
+// Called for every event of a command with an id; detail may be empty
+typedef void (*queue_event_t)(const char * id, const char * event, const char * detail);
+
+class CommandQueue
+{
+  QueuedCommand q[QUEUE_DEPTH];
+  uint8_t head = 0;
+  uint8_t used = 0;
+  uint8_t step = 0;          // of the command at head
+  queue_event_t hook = nullptr;
+
+  void event(const QueuedCommand & c, const char * name, const char * detail);
+  void pop();
+
+  public:
+
+  // In-progress state of the current step, owned by the caller
+  bool started = false;
+  uint32_t started_ms = 0;
+
+  void SetEventHook(queue_event_t h) { hook = h; }
+
+  // Split off an optional "<id>:" prefix; returns the rest of text
+  static const char * SplitId(const char * text, char * id);
+
+  // Parse the steps of text (without the id); returns an error or nullptr
+  static const char * Parse(const char * text, QueuedCommand & out);
+
+  // Append a command; reports accepted, or failed if the queue is full
+  bool Push(const QueuedCommand & c);
+
+  // Parse and append "[<id>:]<steps>"; reports failed on a parse error
+  bool Push(const char * text);
+
+  // Parse "[<id>:]<steps>" and run it in place of everything queued; a
+  // command that does not parse is reported failed and leaves the queue alone
+  bool Replace(const char * text);
+
+  // Drop every queued command, including the running one
+  void Supersede();
+
+  // The running step failed: report the command failed and drop the rest
+  void Fail(const char * reason);
+
+  // The running step is done; reports completed after the last one
+  void StepDone(const char * detail = "");
+
+  // The step to run, or nullptr if the queue is empty
+  const QueueStep * Current();
+
+  bool Empty() { return used == 0; }
+};
+
+#endif // COMMAND_QUEUE_H
@@ -0,0 +1,59 @@
+#include "DeskState.h"
+#include "Arduino.h"
+
+#define DESK_STATE_MAGIC 0x4b534544  // "DESK"
+
+struct DeskStateRecord {
+  uint32_t magic;
+  DeskState state;
+  uint32_t crc;
+};
+
+static_assert(sizeof(DeskStateRecord) % 4 == 0, "RTC memory is accessed in 4-byte blocks");
+static_assert(DESK_STATE_RTC_OFFSET + sizeof(DeskStateRecord) / 4 <= 64, "the record would overlap the eboot command");
+static_assert(sizeof(DeskState) <= FLASH_LOG_PAYLOAD, "state does not fit a flash record");
+
+static void seal(DeskStateRecord & r, const DeskState & s) {
+  r.magic = DESK_STATE_MAGIC;
+  r.state = s;
+  r.crc = FlashLog::Crc32(&r, offsetof(DeskStateRecord, crc));
+}
+
+static bool valid(const DeskStateRecord & r) {
+  return r.magic == DESK_STATE_MAGIC && r.crc == FlashLog::Crc32(&r, offsetof(DeskStateRecord, crc));
+}
+
+void DeskStateStore::Begin(FlashLog & log, uint8_t key) {
+  this->log = &log;
+  this->key = key;
+}
+
+DeskStateStore::Source DeskStateStore::Load(DeskState & out) {
+  DeskStateRecord r;
+  if (ESP.rtcUserMemoryRead(DESK_STATE_RTC_OFFSET, (uint32_t *)&r, sizeof(r)) && valid(r)) {
+    out = r.state;
+    return RTC;
+  }
+
+  if (log && log->Get(key, &out, sizeof(out)))
+    return FLASH;
+  return NONE;
+}
+
+void DeskStateStore::Save(const DeskState & s) {
+  DeskStateRecord r;
+  seal(r, s);
+  ESP.rtcUserMemoryWrite(DESK_STATE_RTC_OFFSET, (uint32_t *)&r, sizeof(r));
+}
+
+bool DeskStateStore::Persist(const DeskState & s) {
+  return log && log->Put(key, &s, sizeof(s));
+}
+
+const char * DeskStateStore::SourceName(Source s) {
+  switch (s) {
+    case RTC: return "RTC memory";
+    case FLASH: return "flash";
+    default: return "nowhere";
+  }
+}
@@ -0,0 +1,57 @@
+//////////////////////////////////////////////////////////
+//
+// Desk state across resets
+//
+// Keeps the last known height, the high/low targets and the direction of
+// motion so a restart does not need to jog the desk to learn where it is.
+// The state is mirrored into RTC user memory on every change, which is cheap
+// and survives warm resets (watchdog, exception, OTA), and kept as a record
+// in the flash store, which survives power loss.
+//
+// The RTC copy carries a magic and a CRC; garbage after a cold boot simply
+// reads as "no state".
+//
+
+#ifndef DESK_STATE_H
+#define DESK_STATE_H
+
+#include <stdint.h>
+#include <FlashLog.h>
+
+// In 4-byte blocks from the start of user memory (0x60001100). eboot keeps
+// its OTA command at 0x60001200, which is block 64, so stay below that.
+#define DESK_STATE_RTC_OFFSET 0
+
+struct DeskState {
+  uint8_t height;       // 0 is unknown
+  uint8_t high_target;
+  uint8_t low_target;
+  int8_t direction;     // 1 up, -1 down, 0 stopped when the state was saved
+};
+
+class DeskStateStore
+{
+  FlashLog * log = nullptr;
+  uint8_t key = 0;
+
+  public:
+
+  enum Source : uint8_t { NONE, RTC, FLASH };
+
+  // Call once from setup(), after log.Begin(); the state is kept under key
+  void Begin(FlashLog & log, uint8_t key);
+
+  // Restore the state, preferring RTC memory over flash
+  Source Load(DeskState & out);
+
+  // Mirror the state into RTC memory; call on every change
+  void Save(const DeskState & s);
+
+  // Hand the state to the flash store; it is written on the store's next
+  // Service() if it differs from what is there
+  bool Persist(const DeskState & s);
+
+  static const char * SourceName(Source s);
+};
+
+#endif // DESK_STATE_H
@@ -0,0 +1,34 @@
+#include "DutyCycle.h"
+
+void DutyCycle::Idle(uint32_t us, bool woken) {
+  idle_us += us;
+  naps++;
+  if (woken)
+    wakeups++;
+}
+
+static uint8_t share(uint32_t idle_us, uint32_t elapsed) {
+  uint32_t idle_ms = idle_us / 1000;
+  return idle_ms >= elapsed ? 0 : 100 - idle_ms * 100 / elapsed;
+}
+
+void DutyCycle::Update(uint32_t now) {
+  last_update = now;
+  uint32_t elapsed = now - window_start;
+  if (elapsed < DUTY_WINDOW_MS)
+    return;
+
+  busy = share(idle_us, elapsed);
+  complete = true;
+  window_start = now;
+  idle_us = 0;
+}
+
+uint8_t DutyCycle::Busy() {
+  if (complete)
+    return busy;
+
+  // the first window is still open, report what there is of it
+  uint32_t elapsed = last_update - window_start;
+  return elapsed ? share(idle_us, elapsed) : 0;
+}
@@ -0,0 +1,42 @@
+//////////////////////////////////////////////////////////
+//
+// Busy/idle accounting of the main loop
+//
+// The loop reports the time it spent napping; everything else counts as
+// busy. Busy() is the share of the last complete window, so a reading is
+// stable for DUTY_WINDOW_MS and not skewed by the window in progress. Until
+// the first window has closed it is the share of the time so far.
+//
+
+#ifndef DUTY_CYCLE_H
+#define DUTY_CYCLE_H
+
+#include <stdint.h>
+
+#ifndef DUTY_WINDOW_MS
+#define DUTY_WINDOW_MS 10000
+#endif
+
+class DutyCycle
+{
+  uint32_t window_start = 0;  // ms
+  uint32_t last_update = 0;   // ms
+  uint32_t idle_us = 0;       // in the current window
+  uint8_t busy = 0;           // percent, of the last window
+  bool complete = false;      // a whole window has elapsed
+
+  public:
+
+  uint32_t naps = 0;
+  uint32_t wakeups = 0;       // naps cut short by an event
+
+  // Account a nap of us microseconds; woken if an event ended it early
+  void Idle(uint32_t us, bool woken);
+
+  // Call once per loop pass; closes the window when it is over
+  void Update(uint32_t now);
+
+  uint8_t Busy();
+};
+
+#endif // DUTY_CYCLE_H
@@ -0,0 +1,100 @@
+#include "EdgeCapture.h"
+#include <LogicData.h>
+
+#define CAPTURE_MASK (CAPTURE_BUFFER_SIZE - 1)
+
+void EdgeCapture::Start() {
+  noInterrupts();
+  head = tail = 0;
+  edges = overruns = 0;
+  synced = false;
+  active = true;
+  interrupts();
+}
+
+void EdgeCapture::Stop() {
+  active = false;
+}
+
+size_t IRAM_ATTR EdgeCapture::Encode(uint32_t v, uint8_t * out) {
+  size_t n = 0;
+  while (v >= 0x80) {
+    out[n++] = (v & 0x7F) | 0x80;
+    v >>= 7;
+  }
+  out[n++] = v;
+  return n;
+}
+
+size_t EdgeCapture::Decode(const uint8_t * in, size_t len, uint32_t & v) {
+  v = 0;
+  for (size_t n = 0; n < len && n < 5; n++) {
+    v |= uint32_t(in[n] & 0x7F) << (7 * n);
+    if (!(in[n] & 0x80)) return n + 1;
+  }
+  return 0;
+}
+
+void IRAM_ATTR EdgeCapture::Push(uint32_t delta, bool level) {
+  // Assumes interrupts disabled (called from PinChange)
+  if (!active) return;
+
+  if (delta == GLITCH) {
+    // Take back the latest entry unless it was already streamed out
+    if (synced && last_len && head - tail >= last_len) {
+      head -= last_len;
+      edges--;
+      last_len = 0;
+    } else {
+      synced = false;
+    }
+    return;
+  }
+
+  uint8_t tmp[1 + 5];
+  size_t n = 0;
+
+  // 0 is reserved for the gap marker
+  if (!delta) delta = 1;
+
+  if (!synced) {
+    // (Re)start on an even queue entry so the host sees the same level pairing
+    if (level) return;
+    tmp[n++] = CAPTURE_GAP;
+    delta = uint32_t(-1);
+  }
+  n += Encode(delta, tmp + n);
+
+  if (CAPTURE_BUFFER_SIZE - (head - tail) < n) {
+    overruns++;
+    synced = false;
+    return;
+  }
+
+  for (size_t i = 0; i < n; i++) {
+    buf[(head + i) & CAPTURE_MASK] = tmp[i];
+  }
+  head += n;
+  edges++;
+  last_len = synced ? n : 0;
+  synced = true;
+}
+
+size_t EdgeCapture::ReadFrame(uint8_t * out) {
+  // Push may take back the latest entry; hold it off until tail has moved
+  // past what was copied, or a retraction in between leaves tail beyond head
+  lock _;
+  uint32_t avail = head - tail;
+  if (!avail) return 0;
+  if (avail > CAPTURE_CHUNK_SIZE) avail = CAPTURE_CHUNK_SIZE;
+
+  out[0] = CAPTURE_FRAME_MAGIC;
+  out[1] = seq++;
+  out[2] = avail & 0xFF;
+  out[3] = avail >> 8;
+  for (uint32_t i = 0; i < avail; i++) {
+    out[CAPTURE_FRAME_HEADER + i] = buf[(tail + i) & CAPTURE_MASK];
+  }
+  tail += avail;
+  return CAPTURE_FRAME_HEADER + avail;
+}
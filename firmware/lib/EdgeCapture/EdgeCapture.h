@@ -0,0 +1,64 @@
+//////////////////////////////////////////////////////////
+//
+// Raw LogicData edge capture
+//
+// Records the edge deltas that LogicData::PinChange pushes into its queue
+// into a byte ring, varint-encoded (a 1ms bit fits in 2 bytes). The main
+// loop drains the ring in chunks, each prefixed with a small frame header
+// so a host can append them to a file and replay them through ReadTrace.
+//
+// Stream format, after framing is removed:
+//   varint  edge delta in us; entries alternate SPACE/MARK starting with
+//           the entry the decoder sees at an even queue index
+//   0x00    gap marker: edges were lost, the next delta is BIG_IDLE
+//
+// Frame format: 'E', seq (uint8), len (uint16 LE), len bytes of stream.
+//
+
+#ifndef EDGE_CAPTURE_H
+#define EDGE_CAPTURE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "Arduino.h"
+
+#define CAPTURE_BUFFER_SIZE 8192 // must be a power of two
+#define CAPTURE_CHUNK_SIZE 128   // payload per frame; fits PubSubClient's default buffer
+#define CAPTURE_FRAME_MAGIC 'E'
+#define CAPTURE_FRAME_HEADER 4
+#define CAPTURE_GAP 0x00
+
+class EdgeCapture
+{
+  uint8_t buf[CAPTURE_BUFFER_SIZE];
+  volatile uint32_t head = 0;  // written by the ISR
+  volatile uint32_t tail = 0;  // written by the main loop
+  bool synced = false;
+  uint8_t last_len = 0;  // bytes of the latest entry, for retracting glitches
+  uint8_t seq = 0;
+
+  public:
+
+  volatile bool active = false;
+  volatile uint32_t edges = 0;
+  volatile uint32_t overruns = 0;
+
+  void Start();
+  void Stop();
+
+  // ISR side: record one queue entry; level is the level PinChange saw.
+  // GLITCH retracts the latest entry.
+  void Push(uint32_t delta, bool level);
+
+  uint32_t Available() { return head - tail; }
+
+  // Main loop side: fill out with one frame (header + up to CAPTURE_CHUNK_SIZE
+  // bytes); returns frame length or 0 if there is nothing to send
+  size_t ReadFrame(uint8_t * out);
+
+  // varint helpers; Decode returns the number of bytes consumed, 0 if truncated
+  static size_t Encode(uint32_t v, uint8_t * out);
+  static size_t Decode(const uint8_t * in, size_t len, uint32_t & v);
+};
+
+#endif // EDGE_CAPTURE_H
@@ -0,0 +1,49 @@
+//////////////////////////////////////////////////////////
+//
+// Direct register access to a GPIO pin
+//
+// digitalRead()/digitalWrite() look the pin up and check its mode on every
+// call. With the pin number known at compile time a read is one load from
+// the GPIO input register and a write one store to the set or clear
+// register, short enough for the edge interrupt and the motor outputs.
+//
+//   typedef FastPin<ASSERT_UP> assertUp;
+//   assertUp::Write(HIGH);
+//
+// pinMode() still has to be called as usual. GPIO16 sits in the RTC block
+// without set/clear registers and goes through the Arduino functions, as
+// does everything on hosts, where those are the stand-ins the tools drive.
+//
+
+#ifndef FAST_PIN_H
+#define FAST_PIN_H
+
+#include <stdint.h>
+#include "Arduino.h"
+
+template <uint8_t PIN>
+struct FastPin
+{
+  static_assert(PIN <= 16, "the ESP8266 has GPIO0-16");
+
+  // always inlined, so they end up in IRAM with the interrupt handlers using them
+#ifdef ESP8266
+  static inline __attribute__((always_inline)) bool Read() {
+    return PIN < 16 ? (GPI & (1 << PIN)) != 0 : digitalRead(PIN);
+  }
+
+  static inline __attribute__((always_inline)) void Write(bool high) {
+    if (PIN == 16)
+      digitalWrite(PIN, high);
+    else if (high)
+      GPOS = 1 << PIN;
+    else
+      GPOC = 1 << PIN;
+  }
+#else
+  static inline bool Read() { return digitalRead(PIN) == HIGH; }
+  static inline void Write(bool high) { digitalWrite(PIN, high ? HIGH : LOW); }
+#endif
+};
+
+#endif // FAST_PIN_H
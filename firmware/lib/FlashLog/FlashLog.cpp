@@ -0,0 +1,216 @@
+#include "FlashLog.h"
+#include "Arduino.h"
+
+#define FLASH_LOG_MAGIC 0x474f4c46  // "FLOG"
+#define FLASH_LOG_HEADER 0xfe       // key of the sector header record
+
+static_assert(sizeof(FlashLogRecord) == 16, "records are written in 4-byte words");
+static_assert(FLASH_LOG_KEYS <= 8, "keys are tracked in 8-bit masks");
+static_assert(FLASH_LOG_SECTORS >= 2, "the ring needs a sector to carry records into");
+
+#ifdef ESP8266
+extern "C" uint32_t _FS_start;
+extern "C" uint32_t _FS_end;
+#define FLASH_LOG_FIRST_SECTOR (((uint32_t)&_FS_start - 0x40200000) / FLASH_LOG_SECTOR_SIZE)
+#define FLASH_LOG_AVAILABLE (((uint32_t)&_FS_end - (uint32_t)&_FS_start) / FLASH_LOG_SECTOR_SIZE)
+#else
+#define FLASH_LOG_FIRST_SECTOR 0
+#define FLASH_LOG_AVAILABLE FLASH_LOG_SECTORS
+#endif
+
+static void seal(FlashLogRecord & r) {
+  r.crc = FlashLog::Crc32(&r, offsetof(FlashLogRecord, crc));
+}
+
+static bool valid(const FlashLogRecord & r) {
+  return r.key != 0xff && r.len <= FLASH_LOG_PAYLOAD && r.crc == FlashLog::Crc32(&r, offsetof(FlashLogRecord, crc));
+}
+
+static bool erased(const FlashLogRecord & r) {
+  const uint8_t * p = (const uint8_t *)&r;
+  for (size_t i = 0; i < sizeof(r); i++) {
+    if (p[i] != 0xff) return false;
+  }
+  return true;
+}
+
+uint32_t FlashLog::Crc32(const void * data, uint32_t len) {
+  const uint8_t * p = (const uint8_t *)data;
+  uint32_t crc = 0xffffffff;
+  while (len--) {
+    crc ^= *p++;
+    for (uint8_t i = 0; i < 8; i++)
+      crc = (crc >> 1) ^ (0xedb88320 & -(crc & 1));
+  }
+  return ~crc;
+}
+
+FlashLog::FlashLog() {
+  memset(latest, 0xff, sizeof(latest));
+  memset(latest_sector, 0xff, sizeof(latest_sector));
+}
+
+uint32_t FlashLog::address(uint8_t sector, uint16_t slot) {
+  return (first_sector + sector) * FLASH_LOG_SECTOR_SIZE + slot * sizeof(FlashLogRecord);
+}
+
+bool FlashLog::read(uint8_t sector, uint16_t slot, FlashLogRecord & r) {
+  return ESP.flashRead(address(sector, slot), (uint32_t *)&r, sizeof(r));
+}
+
+bool FlashLog::readSeq(uint8_t sector, uint32_t & s) {
+  FlashLogRecord r;
+  uint32_t magic;
+  if (!read(sector, 0, r) || !valid(r) || r.key != FLASH_LOG_HEADER)
+    return false;
+  memcpy(&magic, r.data, 4);
+  memcpy(&s, r.data + 4, 4);
+  return magic == FLASH_LOG_MAGIC;
+}
+
+bool FlashLog::startSector(uint8_t sector, uint32_t s) {
+  if (!ESP.flashEraseSector(first_sector + sector))
+    return false;
+  erases++;
+
+  FlashLogRecord r;
+  uint32_t magic = FLASH_LOG_MAGIC;
+  memset(&r, 0xff, sizeof(r));
+  r.key = FLASH_LOG_HEADER;
+  r.len = 8;
+  memcpy(r.data, &magic, 4);
+  memcpy(r.data + 4, &s, 4);
+  seal(r);
+  if (!ESP.flashWrite(address(sector, 0), (uint32_t *)&r, sizeof(r)))
+    return false;
+
+  head = sector;
+  seq = s;
+  slot = 1;
+  return true;
+}
+
+bool FlashLog::Begin() {
+  first_sector = FLASH_LOG_FIRST_SECTOR;
+  if (FLASH_LOG_AVAILABLE < FLASH_LOG_SECTORS)
+    return false;
+
+  // the newest sector has the highest sequence number
+  bool any = false;
+  for (uint8_t i = 0; i < FLASH_LOG_SECTORS; i++) {
+    uint32_t s;
+    if (readSeq(i, s) && (!any || int32_t(s - seq) > 0)) {
+      head = i;
+      seq = s;
+      any = true;
+    }
+  }
+  if (!any)
+    return ready = startSector(0, 1);
+
+  // records are appended, so the used slots are a prefix of the sector
+  uint16_t lo = 1, hi = FLASH_LOG_SLOTS;
+  while (lo < hi) {
+    uint16_t mid = (lo + hi) / 2;
+    FlashLogRecord r;
+    if (read(head, mid, r) && erased(r))
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  slot = lo;
+
+  // walk back until every key has its newest record, or the ring ends
+  const uint8_t all = (1 << FLASH_LOG_KEYS) - 1;
+  for (uint8_t back = 0; back < FLASH_LOG_SECTORS && found != all; back++) {
+    uint8_t sector = (head + FLASH_LOG_SECTORS - back) % FLASH_LOG_SECTORS;
+    uint32_t s;
+    if (back && (!readSeq(sector, s) || s != seq - back))
+      break;
+
+    for (uint16_t i = back ? FLASH_LOG_SLOTS : slot; i-- > 1 && found != all; ) {
+      FlashLogRecord r;
+      if (!read(sector, i, r) || !valid(r) || r.key >= FLASH_LOG_KEYS || (found & (1 << r.key)))
+        continue;
+      latest[r.key] = r;
+      latest_sector[r.key] = sector;
+      found |= 1 << r.key;
+    }
+  }
+  return ready = true;
+}
+
+bool FlashLog::Get(uint8_t key, void * out, uint8_t len) {
+  if (key >= FLASH_LOG_KEYS || !(found & (1 << key)) || latest[key].len != len)
+    return false;
+  memcpy(out, latest[key].data, len);
+  return true;
+}
+
+bool FlashLog::Put(uint8_t key, const void * data, uint8_t len) {
+  if (key >= FLASH_LOG_KEYS || len > FLASH_LOG_PAYLOAD)
+    return false;
+
+  FlashLogRecord & r = latest[key];
+  if ((found & (1 << key)) && r.len == len && !memcmp(r.data, data, len))
+    return true;
+
+  memset(&r, 0xff, sizeof(r));
+  r.key = key;
+  r.len = len;
+  memcpy(r.data, data, len);
+  found |= 1 << key;
+  pending |= 1 << key;
+  return true;
+}
+
+bool FlashLog::append(uint8_t key) {
+  FlashLogRecord r = latest[key];
+  seal(r);
+  // the slot is used up even if the write failed half way
+  bool ok = ESP.flashWrite(address(head, slot++), (uint32_t *)&r, sizeof(r));
+  writes++;
+  if (ok) {
+    latest_sector[key] = head;
+    pending &= ~(1 << key);
+  }
+  return ok;
+}
+
+bool FlashLog::Service() {
+  if (!ready || !pending)
+    return false;
+
+  uint16_t free = FLASH_LOG_SLOTS - slot;
+  if (free <= FLASH_LOG_KEYS) {
+    // move on to the oldest sector, after carrying forward what still lives there
+    uint8_t next = (head + 1) % FLASH_LOG_SECTORS;
+    for (uint8_t key = 0; key < FLASH_LOG_KEYS; key++) {
+      if (latest_sector[key] != next)
+        continue;
+      if (free) {
+        // a failed carry is retried on the next call
+        if (!append(key))
+          failures++;
+        return true;
+      }
+      // the reserved slots went to failed writes and next still holds the
+      // only copy of key: erasing it would lose the value, so stop writing
+      failures++;
+      ready = false;
+      return false;
+    }
+    if (!startSector(next, seq + 1))
+      failures++;
+    return true;
+  }
+
+  for (uint8_t key = 0; key < FLASH_LOG_KEYS; key++) {
+    if (pending & (1 << key)) {
+      if (!append(key))
+        failures++;
+      return true;
+    }
+  }
+  return false;
+}
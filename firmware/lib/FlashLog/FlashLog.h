@@ -0,0 +1,96 @@
+//////////////////////////////////////////////////////////
+//
+// Log-structured record store on raw flash
+//
+// Small keyed records (settings, presets, desk state) are appended to a ring
+// of flash sectors instead of rewriting one sector in place, so every sector
+// is erased once per trip around the ring. Each sector starts with a header
+// record carrying a sequence number; the newest sector is found from the
+// headers, its write position by binary search over the appended slots, and
+// the newest record per key by walking back from there.
+//
+// Records carry a CRC, so a write torn by a reset is skipped on the next boot.
+// The newest value of every key is cached in RAM: Put() and Get() never touch
+// flash, Service() writes at most one record or erases one sector per call so
+// the caller decides when flash may stall the CPU. A value changed many times
+// before Service() runs costs one record.
+//
+// Before the oldest sector is erased, the records in it that are still the
+// newest of their key are carried forward, for which the last
+// FLASH_LOG_KEYS slots of a sector are reserved. A sector is never erased
+// while it holds the only copy of a record; if failed writes used up the
+// reserved slots first, the store stops writing and keeps the values in RAM.
+//
+// On the ESP8266 the store uses the first sectors of the filesystem area, so
+// it must not share the board with a SPIFFS/LittleFS image.
+//
+
+#ifndef FLASH_LOG_H
+#define FLASH_LOG_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FLASH_LOG_SECTOR_SIZE 4096
+#define FLASH_LOG_SECTORS 4       // ring size, at least 2
+#define FLASH_LOG_KEYS 8          // keys are 0 .. FLASH_LOG_KEYS - 1
+#define FLASH_LOG_PAYLOAD 8       // bytes per record
+#define FLASH_LOG_SLOTS (FLASH_LOG_SECTOR_SIZE / sizeof(FlashLogRecord))
+
+struct FlashLogRecord {
+  uint8_t key;       // 0xff: erased slot
+  uint8_t len;
+  uint8_t reserved[2];
+  uint8_t data[FLASH_LOG_PAYLOAD];
+  uint32_t crc;      // over everything before it
+};
+
+class FlashLog
+{
+  FlashLogRecord latest[FLASH_LOG_KEYS];
+  uint8_t latest_sector[FLASH_LOG_KEYS];  // where latest[] is on flash, 0xff if not yet
+  uint8_t found = 0;    // keys with a value
+  uint8_t pending = 0;  // keys whose value is not on flash yet
+
+  uint32_t first_sector = 0;  // absolute flash sector of the ring
+  bool ready = false;
+  uint8_t head = 0;           // ring index of the sector being written
+  uint16_t slot = 0;          // next free slot in it
+  uint32_t seq = 0;           // sequence number of head
+
+  uint32_t address(uint8_t sector, uint16_t slot);
+  bool read(uint8_t sector, uint16_t slot, FlashLogRecord & r);
+  bool readSeq(uint8_t sector, uint32_t & s);
+  bool startSector(uint8_t sector, uint32_t s);
+  bool append(uint8_t key);
+
+  public:
+
+  uint32_t writes = 0;
+  uint32_t erases = 0;
+  uint32_t failures = 0;  // failed writes and erases
+
+  FlashLog();
+
+  // Find the newest records; formats the ring if it holds none.
+  // Returns false if there is no flash for the store; values are then kept in RAM only.
+  bool Begin();
+
+  // Copy the newest value of key to out; false if there is none of that size
+  bool Get(uint8_t key, void * out, uint8_t len);
+
+  // Set the value of key; it goes to flash on a later Service()
+  bool Put(uint8_t key, const void * data, uint8_t len);
+
+  bool Pending() { return ready && pending; }
+
+  // False if there is no flash for the store, or it stopped writing after failures
+  bool Ready() { return ready; }
+
+  // Do one step of pending flash work; returns true if flash was touched
+  bool Service();
+
+  static uint32_t Crc32(const void * data, uint32_t len);
+};
+
+#endif // FLASH_LOG_H
@@ -0,0 +1,238 @@
+#include "HeightHistory.h"
+#include "FlashLog.h"
+#include "Arduino.h"
+
+#define HISTORY_MAGIC 0x54534948  // "HIST"
+#define HISTORY_SECTORS 2
+#define HISTORY_GAP_S 10          // longer without a Tick() and the time is not accounted
+
+static_assert(sizeof(HistoryBucket) == 8, "buckets are packed");
+static_assert(HISTORY_EVENT_BYTES <= 65535, "ring positions are 16 bit");
+
+// the two sectors right after the flash store
+#ifdef ESP8266
+extern "C" uint32_t _FS_start;
+extern "C" uint32_t _FS_end;
+#define HISTORY_FIRST_SECTOR (((uint32_t)&_FS_start - 0x40200000) / FLASH_LOG_SECTOR_SIZE + FLASH_LOG_SECTORS)
+#define HISTORY_AVAILABLE (((uint32_t)&_FS_end - (uint32_t)&_FS_start) / FLASH_LOG_SECTOR_SIZE >= FLASH_LOG_SECTORS + HISTORY_SECTORS)
+#else
+#define HISTORY_FIRST_SECTOR FLASH_LOG_SECTORS
+#define HISTORY_AVAILABLE true
+#endif
+
+static const uint32_t period_s[3] = {60, 3600, 86400};
+
+HeightHistory::HeightHistory() {
+  static_assert(sizeof(d) % 4 == 0 && sizeof(d) <= FLASH_LOG_SECTOR_SIZE, "history is written in 4-byte words to one sector");
+  memset(&d, 0, sizeof(d));
+}
+
+HistoryBucket * HeightHistory::level(HistoryLevel l, uint8_t & size) {
+  switch (l) {
+    case HISTORY_MINUTE: size = HISTORY_MINUTES; return d.minutes;
+    case HISTORY_HOUR: size = HISTORY_HOURS; return d.hours;
+    default: size = HISTORY_DAYS; return d.days;
+  }
+}
+
+uint32_t HeightHistory::periodOf(HistoryLevel l, uint32_t t) {
+  return (t + HISTORY_UTC_OFFSET) / period_s[l];
+}
+
+void HeightHistory::roll(HistoryLevel l, uint32_t period) {
+  if (period == d.period[l])
+    return;
+
+  // clear the slots of the periods skipped and of the new one
+  uint8_t size;
+  HistoryBucket * b = level(l, size);
+  if (!d.period[l] || period - d.period[l] >= size) {
+    memset(b, 0, size * sizeof(HistoryBucket));
+  } else {
+    for (uint32_t p = d.period[l] + 1; p != period + 1; p++)
+      memset(&b[p % size], 0, sizeof(HistoryBucket));
+  }
+  d.period[l] = period;
+  d.sum[l] = 0;
+  d.seconds[l] = 0;
+}
+
+void HeightHistory::account(uint32_t t, uint8_t height, bool stand) {
+  for (uint8_t l = HISTORY_MINUTE; l <= HISTORY_DAY; l++) {
+    roll((HistoryLevel)l, periodOf((HistoryLevel)l, t));
+
+    uint8_t size;
+    HistoryBucket & b = level((HistoryLevel)l, size)[d.period[l] % size];
+    d.sum[l] += height;
+    d.seconds[l]++;
+    // days count minutes, which are whole once 60 seconds are in
+    if (l != HISTORY_DAY) {
+      (stand ? b.stand : b.sit)++;
+    } else if (t % 60 == 59) {
+      (stand ? b.stand : b.sit)++;
+    }
+    b.mean = d.sum[l] / d.seconds[l];
+    if (!b.low || height < b.low) b.low = height;
+    if (height > b.high) b.high = height;
+  }
+}
+
+uint8_t HeightHistory::byteAt(uint16_t pos) {
+  return d.ring[(d.tail + pos) % HISTORY_EVENT_BYTES];
+}
+
+uint8_t HeightHistory::decode(uint16_t pos, uint32_t & dt, int8_t & dh) {
+  uint8_t len = 0, b;
+  dt = 0;
+  do {
+    b = byteAt(pos + len);
+    dt |= uint32_t(b & 0x7f) << (7 * len);
+    len++;
+  } while (b & 0x80 && len < 5);
+  dh = (int8_t)byteAt(pos + len);
+  return len + 1;
+}
+
+void HeightHistory::append(uint32_t t, uint8_t height) {
+  int16_t delta = height - d.last_height;
+  uint32_t dt = t - d.last_time;
+
+  // desk heights differ by far less, but a larger step still fits in two records
+  while (delta) {
+    int8_t dh = constrain(delta, -127, 127);
+    uint8_t rec[6], n = 0;
+    do {
+      rec[n] = dt & 0x7f;
+      dt >>= 7;
+      if (dt) rec[n] |= 0x80;
+      n++;
+    } while (dt);
+    rec[n++] = (uint8_t)dh;
+
+    // fold the oldest transitions into the base until the record fits
+    while (HISTORY_EVENT_BYTES - d.used < n) {
+      uint32_t odt;
+      int8_t odh;
+      uint8_t len = decode(0, odt, odh);
+      d.base_time += odt;
+      d.base_height += odh;
+      d.tail = (d.tail + len) % HISTORY_EVENT_BYTES;
+      d.used -= len;
+    }
+    for (uint8_t i = 0; i < n; i++)
+      d.ring[(d.tail + d.used + i) % HISTORY_EVENT_BYTES] = rec[i];
+    d.used += n;
+    delta -= dh;
+  }
+  d.last_time = t;
+  d.last_height = height;
+}
+
+bool HeightHistory::Begin() {
+  if (!HISTORY_AVAILABLE)
+    return false;
+  first_sector = HISTORY_FIRST_SECTOR;
+
+  // the valid copy with the higher sequence number wins
+  int8_t newest = -1;
+  uint32_t seq = 0;
+  for (uint8_t i = 0; i < HISTORY_SECTORS; i++) {
+    if (!ESP.flashRead((first_sector + i) * FLASH_LOG_SECTOR_SIZE, (uint32_t *)&d, sizeof(d)))
+      continue;
+    if (d.magic != HISTORY_MAGIC || d.crc != FlashLog::Crc32(&d, offsetof(Data, crc)))
+      continue;
+    if (newest < 0 || int32_t(d.seq - seq) > 0) {
+      newest = i;
+      seq = d.seq;
+    }
+  }
+
+  if (newest < 0 || !ESP.flashRead((first_sector + newest) * FLASH_LOG_SECTOR_SIZE, (uint32_t *)&d, sizeof(d)))
+    memset(&d, 0, sizeof(d));
+  return ready = true;
+}
+
+void HeightHistory::Tick(uint32_t now, uint8_t height, bool moving) {
+  if (!now || !height)
+    return;
+  if (!persisted)
+    persisted = now;
+
+  if (!d.last || now - d.last > HISTORY_GAP_S || now < d.last) {
+    // first time, or after a reset or a clock step: start over from now
+    for (uint8_t l = HISTORY_MINUTE; l <= HISTORY_DAY; l++)
+      roll((HistoryLevel)l, periodOf((HistoryLevel)l, now));
+    d.last = now;
+  }
+  while (d.last != now)
+    account(++d.last, height, height >= stand_height);
+
+  if (moving) {
+    rest_since = 0;
+    return;
+  }
+  if (!rest_since)
+    rest_since = now;
+  if (now - rest_since < HISTORY_SETTLE_S || height == d.last_height)
+    return;
+
+  if (!d.base_time) {
+    d.base_time = d.last_time = rest_since;
+    d.base_height = d.last_height = height;
+  } else {
+    append(rest_since, height);
+  }
+}
+
+bool HeightHistory::Persist(uint32_t now) {
+  if (!ready)
+    return false;
+  persisted = now;
+
+  d.magic = HISTORY_MAGIC;
+  d.seq++;
+  d.crc = FlashLog::Crc32(&d, offsetof(Data, crc));
+  uint32_t sector = first_sector + d.seq % HISTORY_SECTORS;
+  return ESP.flashEraseSector(sector) &&
+         ESP.flashWrite(sector * FLASH_LOG_SECTOR_SIZE, (uint32_t *)&d, sizeof(d));
+}
+
+bool HeightHistory::Get(HistoryLevel l, uint8_t age, uint32_t & start, HistoryBucket & out) {
+  uint8_t size;
+  HistoryBucket * b = level(l, size);
+  if (!d.last || age >= size)
+    return false;
+
+  uint32_t period = d.period[l] - age;
+  out = b[period % size];
+  start = period * period_s[l] - HISTORY_UTC_OFFSET;
+  return true;
+}
+
+bool HeightHistory::First(HistoryCursor & c) {
+  c.pos = 0;
+  c.event.time = d.base_time;
+  c.event.height = d.base_height;
+  return d.base_time != 0;
+}
+
+bool HeightHistory::Next(HistoryCursor & c) {
+  if (c.pos >= d.used)
+    return false;
+  uint32_t dt;
+  int8_t dh;
+  c.pos += decode(c.pos, dt, dh);
+  c.event.time += dt;
+  c.event.height += dh;
+  return true;
+}
+
+void HeightHistory::Totals(uint8_t days, uint32_t & stand, uint32_t & sit) {
+  stand = sit = 0;
+  uint32_t start;
+  HistoryBucket b;
+  for (uint8_t age = 0; age < days && Get(HISTORY_DAY, age, start, b); age++) {
+    stand += b.stand;
+    sit += b.sit;
+  }
+}
@@ -0,0 +1,130 @@
+//////////////////////////////////////////////////////////
+//
+// Height history
+//
+// Keeps what the desk did over the last weeks on the device, so sit/stand
+// time can be asked for instead of collected from a stream of heights:
+//
+// - transitions: every height the table settled at, delta encoded (varint
+//   seconds since the previous one, one byte of signed height change) in a
+//   byte ring; when it is full the oldest transitions are folded into the base
+// - rollups: sit/stand time, mean, lowest and highest height per minute (last
+//   hour), per hour (last two days) and per day (last month)
+//
+// Time is Unix seconds, so nothing is recorded before the clock is set.
+// Days start at HISTORY_UTC_OFFSET seconds from UTC midnight. A height at or
+// above the stand threshold counts as standing.
+//
+// Persist() writes the whole history into one of two flash sectors after the
+// flash store, alternating and with a sequence number and CRC, so a write torn
+// by a reset leaves the previous copy. Whatever happened since the last
+// Persist() is lost on a reset.
+//
+
+#ifndef HEIGHT_HISTORY_H
+#define HEIGHT_HISTORY_H
+
+#include <stdint.h>
+
+#define HISTORY_MINUTES 60
+#define HISTORY_HOURS 48
+#define HISTORY_DAYS 31
+#define HISTORY_EVENT_BYTES 256
+#define HISTORY_SETTLE_S 3          // at rest this long before a height counts as a transition
+#ifndef HISTORY_UTC_OFFSET
+#define HISTORY_UTC_OFFSET 0
+#endif
+#ifndef HISTORY_PERSIST_S
+#define HISTORY_PERSIST_S 3600
+#endif
+
+enum HistoryLevel : uint8_t { HISTORY_MINUTE, HISTORY_HOUR, HISTORY_DAY };
+
+// stand/sit are seconds for minutes and hours, minutes for days
+struct HistoryBucket {
+  uint16_t stand;
+  uint16_t sit;
+  uint8_t mean;  // cm, 0 if nothing was recorded
+  uint8_t low;
+  uint8_t high;
+  uint8_t reserved;
+};
+
+struct HistoryEvent {
+  uint32_t time;
+  uint8_t height;
+};
+
+// Position in the transitions, for iterating with First()/Next()
+struct HistoryCursor {
+  uint16_t pos;  // bytes from the oldest transition
+  HistoryEvent event;
+};
+
+class HeightHistory
+{
+  // everything that goes to flash
+  struct Data {
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t last;                // last second accounted
+    uint32_t period[3];           // current minute/hour/day number
+    uint32_t sum[3];              // height seconds in the current period
+    uint32_t seconds[3];          // seconds recorded in the current period
+    HistoryBucket minutes[HISTORY_MINUTES];
+    HistoryBucket hours[HISTORY_HOURS];
+    HistoryBucket days[HISTORY_DAYS];
+    uint32_t base_time;           // before the oldest transition in the ring
+    uint8_t base_height;
+    uint8_t last_height;          // of the newest transition
+    uint16_t tail;                // oldest byte of the ring
+    uint16_t used;
+    uint16_t reserved;
+    uint32_t last_time;           // of the newest transition
+    uint8_t ring[HISTORY_EVENT_BYTES];
+    uint32_t crc;                 // over everything before it
+  } d;
+
+  uint32_t first_sector = 0;
+  bool ready = false;
+  uint32_t rest_since = 0;  // second the table came to rest, 0 while moving
+  uint32_t persisted = 0;   // second of the last Persist()
+
+  HistoryBucket * level(HistoryLevel l, uint8_t & size);
+  uint32_t periodOf(HistoryLevel l, uint32_t t);
+  void account(uint32_t t, uint8_t height, bool stand);
+  void roll(HistoryLevel l, uint32_t period);
+  uint8_t byteAt(uint16_t pos);
+  uint8_t decode(uint16_t pos, uint32_t & dt, int8_t & dh);
+  void append(uint32_t t, uint8_t height);
+
+  public:
+
+  uint8_t stand_height = 100;  // cm, at or above is standing
+
+  HeightHistory();
+
+  // Load the newest copy from flash; call once from setup()
+  bool Begin();
+
+  // Call from loop() with the Unix time (0 if unknown), the height and
+  // whether the table is moving
+  void Tick(uint32_t now, uint8_t height, bool moving);
+
+  // A Persist() is due; the caller picks a moment flash may stall the CPU
+  bool PersistDue(uint32_t now) { return ready && now && d.last && now - persisted >= HISTORY_PERSIST_S; }
+  bool Persist(uint32_t now);
+
+  // Rollup of age periods back (0 is the current one), with its start time
+  bool Get(HistoryLevel l, uint8_t age, uint32_t & start, HistoryBucket & out);
+
+  // Iterate over the transitions, oldest first: First() gives the height the
+  // history starts with, false if there is none yet
+  bool First(HistoryCursor & c);
+  bool Next(HistoryCursor & c);
+
+  // Stand/sit minutes over the current and the days - 1 days before
+  void Totals(uint8_t days, uint32_t & stand, uint32_t & sit);
+};
+
+#endif // HEIGHT_HISTORY_H
@@ -0,0 +1,110 @@
+#include "LocalEndpoint.h"
+
+void LocalEndpoint::Begin(local_handler_t h) {
+  handler = h;
+  server.begin();
+  server.setNoDelay(true);
+  started = true;
+}
+
+void LocalEndpoint::accept() {
+  WiFiClient client = server.available();
+  if (!client)
+    return;
+
+  for (Connection & c : conns) {
+    if (!c.client.connected()) {
+      c.client.stop();
+      c.client = client;
+      c.client.setNoDelay(true);
+      c.used = 0;
+      c.fresh = true;
+      return;
+    }
+  }
+  client.stop();  // full
+}
+
+void LocalEndpoint::receive(Connection & c) {
+  for (uint16_t budget = LOCAL_READ_BUDGET; budget && c.client.available() > 0; budget--) {
+    int b = c.client.read();
+    if (b < 0)
+      break;
+    c.buf[c.used++] = b;
+
+    if (c.used == 1 && c.buf[0] > LOCAL_MAX_PAYLOAD) {
+      // not our protocol
+      c.client.stop();
+      c.used = 0;
+      return;
+    }
+    if (c.used >= 2 && c.used == 2 + c.buf[0]) {
+      uint8_t len = c.buf[0];
+      c.buf[2 + len] = 0;
+      c.used = 0;
+      frames_in++;
+      if (handler)
+        handler(c.buf[1], c.buf + 2, len);
+    }
+  }
+}
+
+bool LocalEndpoint::send(Connection & c, uint8_t type, const uint8_t * payload, uint8_t len) {
+  if (!c.client.connected())
+    return false;
+  if (c.client.availableForWrite() < 2 + len) {
+    dropped++;
+    return false;
+  }
+
+  uint8_t frame[2 + LOCAL_MAX_PAYLOAD];
+  frame[0] = len;
+  frame[1] = type;
+  memcpy(frame + 2, payload, len);
+  c.client.write(frame, 2 + len);
+  frames_out++;
+  return true;
+}
+
+void LocalEndpoint::Service() {
+  if (!started)
+    return;
+
+  accept();
+  for (Connection & c : conns) {
+    if (c.client.connected())
+      receive(c);
+  }
+}
+
+void LocalEndpoint::Send(uint8_t type, const uint8_t * payload, uint8_t len) {
+  if (!started || len > LOCAL_MAX_PAYLOAD)
+    return;
+  for (Connection & c : conns)
+    send(c, type, payload, len);
+}
+
+void LocalEndpoint::Greet(uint8_t height, int8_t direction) {
+  uint8_t payload[2] = {height, (uint8_t)direction};
+  for (Connection & c : conns) {
+    if (c.fresh && send(c, LOCAL_HEIGHT, payload, sizeof(payload)))
+      c.fresh = false;
+  }
+}
+
+uint8_t LocalEndpoint::Clients() {
+  uint8_t n = 0;
+  for (Connection & c : conns) {
+    if (c.client.connected())
+      n++;
+  }
+  return n;
+}
+
+bool LocalEndpoint::Pending() {
+  for (Connection & c : conns) {
+    if (c.client.available())
+      return true;
+  }
+  return false;
+}
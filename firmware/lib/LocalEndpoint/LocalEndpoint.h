@@ -0,0 +1,86 @@
+//////////////////////////////////////////////////////////
+//
+// Local control endpoint
+//
+// Raw TCP next to MQTT for desk-side apps that don't want the broker round
+// trip. Frames are tiny: one length byte, one type byte, then the payload.
+//
+//   client -> desk   'C' cmd, 'S' set, 'Q' queue: the payload is exactly what
+//                    would be published to <MQTT_TOPIC>cmd/set/queue
+//   desk -> client   'H' height in cm and direction (int8, 1 up, -1 down)
+//                    on every change, and once after connecting
+//                    'E' command event text as on <MQTT_TOPIC>event
+//
+// Everything is non-blocking: Service() handles what has arrived and frames
+// for a client whose send buffer is full are dropped. There is no
+// authentication, only enable it (ENABLE_LOCAL_ENDPOINT) on a trusted network.
+//
+
+#ifndef LOCAL_ENDPOINT_H
+#define LOCAL_ENDPOINT_H
+
+#include <stdint.h>
+#include <ESP8266WiFi.h>
+
+#ifndef LOCAL_PORT
+#define LOCAL_PORT 2323
+#endif
+#define LOCAL_MAX_CLIENTS 2
+#define LOCAL_MAX_PAYLOAD 62
+#define LOCAL_READ_BUDGET 128  // bytes per client and Service()
+
+enum LocalFrameType : uint8_t {
+  LOCAL_CMD = 'C',
+  LOCAL_SET = 'S',
+  LOCAL_QUEUE = 'Q',
+  LOCAL_HEIGHT = 'H',
+  LOCAL_EVENT = 'E',
+};
+
+// Called for every received frame; payload is NUL-terminated and may be modified
+typedef void (*local_handler_t)(uint8_t type, uint8_t * payload, uint8_t len);
+
+class LocalEndpoint
+{
+  struct Connection {
+    WiFiClient client;
+    uint8_t buf[2 + LOCAL_MAX_PAYLOAD + 1];
+    uint8_t used = 0;
+    bool fresh = false;  // just connected, wants the current height
+  };
+
+  WiFiServer server;
+  Connection conns[LOCAL_MAX_CLIENTS];
+  local_handler_t handler = nullptr;
+  bool started = false;
+
+  void accept();
+  void receive(Connection & c);
+  bool send(Connection & c, uint8_t type, const uint8_t * payload, uint8_t len);
+
+  public:
+
+  uint32_t frames_in = 0;
+  uint32_t frames_out = 0;
+  uint32_t dropped = 0;  // frames not sent because a client was too slow
+
+  LocalEndpoint(uint16_t port = LOCAL_PORT) : server(port) {}
+
+  void Begin(local_handler_t h);
+
+  // Accept clients, read and dispatch frames; never blocks
+  void Service();
+
+  // Send a frame to every client
+  void Send(uint8_t type, const uint8_t * payload, uint8_t len);
+
+  // Send the height to clients that connected since the last call
+  void Greet(uint8_t height, int8_t direction);
+
+  uint8_t Clients();
+
+  // A client has sent something not read yet
+  bool Pending();
+};
+
+#endif // LOCAL_ENDPOINT_H
@@ -63,7 +63,7 @@ void Logging::print(const char *format, va_list args) {
                 continue;
             }
             if( *format == 's' ) {
-				register char *s = (char *)va_arg( args, int );
+				const char *s = va_arg( args, const char * );
 				_printer->print(s);
 				continue;
 			}
@@ -7,14 +7,18 @@
 // Expect 1 bit per millisecond
 #define SAMPLE_RATE 1000
 
+// The 0x406 preamble starts with pulses of 1, 1, 7 and 2 bits
+#define PREAMBLE_PULSES 4
+#define PREAMBLE_BITS 11
+
 // Push to head; pop from tail
 
-index_t mque::next(index_t x)
+index_t IRAM_ATTR mque::next(index_t x)
 {
   return ( x + 1 ) % Q_MAX;
 }
 
-bool mque::empty() {
+bool IRAM_ATTR mque::empty() {
   return tail == head;
 }
 
@@ -22,19 +26,20 @@ bool mque::full() {
   return next(tail) == head;
 }
 
-index_t mque::size()
+index_t IRAM_ATTR mque::size()
 {
   return (Q_MAX + head - tail) % Q_MAX;
 }
 
 // destructive push; pushes even if full
-void mque::push(micros_t t)
+void IRAM_ATTR mque::push(micros_t t)
 {
   // NOTE: Caller should have disabled interrupts
   trace[head] = t;
   head = next(head);
   if (tail == head) {
     tail = next(tail);
+    overruns++;
   }
 }
 
@@ -48,16 +53,34 @@ bool mque::pop(micros_t * t)
   return true;
 }
 
+// undo the latest push; no-op if empty
+bool IRAM_ATTR mque::unpush(micros_t * t)
+{
+  // NOTE: Caller should have disabled interrupts
+  if (empty()) return false;
+  head = (head + Q_MAX - 1) % Q_MAX;
+  *t = trace[head];
+  retracts++;
+  return true;
+}
+
+// overwrite the latest element; no-op if empty
+void IRAM_ATTR mque::mark(micros_t t)
+{
+  // NOTE: Caller should have disabled interrupts
+  if (empty()) return;
+  trace[(head + Q_MAX - 1) % Q_MAX] = t;
+}
+
 // drop elements from the tail of the queue; no range-checking!
-void mque::drop(index_t n)
+void IRAM_ATTR mque::drop(index_t n)
 {
   lock _;
-  tail += n;
-  tail %= Q_MAX;  // TODO: Check if this is expensive
+  tail = (tail + n) % Q_MAX;
 }
 
 // non-destructive indexed peek
-bool mque::peek(index_t index, micros_t * t)
+bool IRAM_ATTR mque::peek(index_t index, micros_t * t)
 {
   lock _;
   if (index >= size()) return false;
@@ -67,43 +90,97 @@ bool mque::peek(index_t index, micros_t * t)
   return true;
 }
 
+// Single producer, single consumer; no lock needed
+
+bool IRAM_ATTR wque::push(uint32_t w)
+{
+  uint8_t h = head;
+  if (uint8_t(h - tail) >= WORD_Q_MAX) return false;
+  words[h % WORD_Q_MAX] = w;
+  head = h + 1;
+  return true;
+}
+
+bool wque::pop(uint32_t * w)
+{
+  uint8_t t = tail;
+  if (t == head) return false;
+  *w = words[t % WORD_Q_MAX];
+  tail = t + 1;
+  return true;
+}
+
 //------------------------------------------------------
 
 void LogicData::Begin() {
-  if(tx_pin != NULL) {
+  if(tx_pin >= 0) {
     pinMode(tx_pin, OUTPUT);
     SendBit(MARK); // IDLE-CLOSED
   }
 }
 
-void LogicData::PinChange(bool level) {
+void IRAM_ATTR LogicData::PinChange(bool level) {
   // Assumes interrupts disabled
   // Expect HIGH level on even queue steps
   bool sync = q.head & 1;
   if (level == sync) {
     micros_t now = micros();
+    micros_t delta = now-prev_bit;
     if (pin_idle) {
-      q.push(BIG_IDLE);
+      delta = BIG_IDLE;
       pin_idle = false;
-    } else {
-      q.push(now-prev_bit);
+    } else if (delta < min_pulse) {
+      // A spike: this edge and the one before it never happened
+      micros_t prev;
+      if (q.unpush(&prev)) {
+        glitches++;
+        if (prev == BIG_IDLE) {
+          pin_idle = true;
+        } else {
+          prev_bit -= prev;
+        }
+        if (edge_hook) edge_hook(GLITCH, level);
+        return;
+      }
     }
+    push(delta);
+    if (edge_hook) edge_hook(delta, level);
     prev_bit = now;
   }
 }
 
-void LogicData::Service() {
-  micros_t idle_time = micros() - prev_bit;
-  if (!pin_idle && idle_time >= IDLE_TIME) {
-    lock _;
-    if (micros() - prev_bit >= IDLE_TIME) {
-      pin_idle = true;
-    }
+// Frame boundaries: a MARK as long as a start-bit begins a frame, so the SPACE
+// before it becomes BIG_IDLE, however short the gap after the previous word was.
+// ReadTrace finds frames by these marks instead of scanning for start-bits.
+void IRAM_ATTR LogicData::push(micros_t delta) {
+  // NOTE: Caller should have disabled interrupts
+  if ((q.head & 1) && delta >= START_TIME)
+    q.mark(BIG_IDLE);
+  q.push(delta);
+}
+
+void LogicData::Inject(micros_t delta) {
+  lock _;
+  push(delta);
+}
+
+// Once the line has been SPACE for IDLE_TIME the frame is over: ReadTrace can
+// finish a word that ends in SPACE bits without waiting for the next edge, and
+// that edge pushes BIG_IDLE. A MARK that long is a start-bit, not idle.
+void IRAM_ATTR LogicData::Service() {
+  if (tx_state != TX_IDLE || tx_next)
+    Transmit();
+
+  if (pin_idle || micros() - prev_bit < IDLE_TIME)
+    return;
+  lock _;
+  if (!(q.head & 1) && micros() - prev_bit >= IDLE_TIME) {
+    pin_idle = true;
   }
 }
 
 // Calculate parity and set in lsb of message
-uint32_t LogicData::Parity(uint32_t msg) {
+uint32_t IRAM_ATTR LogicData::Parity(uint32_t msg) {
   unsigned par_count = 0;
   for (uint32_t mask = 2; mask ; mask <<= 2) {
       par_count += msg & mask;
@@ -112,7 +189,7 @@ uint32_t LogicData::Parity(uint32_t msg) {
   return msg;
 }
 
-bool LogicData::CheckParity(uint32_t msg) {
+bool IRAM_ATTR LogicData::CheckParity(uint32_t msg) {
   return Parity(msg) == msg;
 }
 
@@ -122,68 +199,140 @@ bool LogicData::CheckParity(uint32_t msg) {
 //  bool level = ((q.size() & 1)==0) ^ !prev_level;
 //}
 
-uint32_t LogicData::ReadTrace() {
+bool IRAM_ATTR LogicData::peek(index_t index, micros_t * t) {
+  if (index < avail) return q.peek(index, t);
+  if (index > avail || !idle_end) return false;
+  *t = BIG_IDLE;
+  return true;
+}
+
+// Drop n decoded or skipped elements, unless an overrun moved the tail or a
+// glitch took back an element under us. Counting overruns also catches the
+// tail coming full circle.
+bool IRAM_ATTR LogicData::consume(index_t n, uint32_t changes) {
+  lock _;
+  if (changes != q.changes()) return false;
+  q.drop(n < avail ? n : avail);
+  return true;
+}
+
+uint32_t IRAM_ATTR LogicData::ReadTrace() {
   index_t fini;
+  uint32_t changes;
 
   {
     lock _;
     fini=q.tail;
+    avail=q.size();
+    changes=q.changes();
+    idle_end=pin_idle;
   }
 
-  bool level = !(fini & 1);
-  micros_t t;
+  micros_t t, t1;
   index_t i=0;
 
-  //-- Find start-bit (idle-low followed by high-pulse shorter than 2-bits)
-  for (; q.peek(i, &t); i++) {
-    if (!level && t > static_cast<micros_t>(40) * SAMPLE_RATE) {
-      micros_t t1;
-      if (q.peek(i+1, &t1) && t1 < SAMPLE_RATE*2)  break;
+  //-- Skip to the next frame: a BIG_IDLE SPACE followed by its start-bit.
+  // After a word the tail is left on the SPACE that follows it, so this is
+  // the first element unless noise or a lost frame came in between.
+  for (;; i++) {
+    if (!peek(i, &t)) {
+      // no frame start yet; keep the last element, it may become one
+      if (i > 1) consume(i - 1, changes);
+      return 0;
+    }
+    if (t == BIG_IDLE && !((fini + i) & 1)) {
+      if (!peek(i+1, &t1)) {
+        if (i) consume(i, changes);
+        return 0;
+      }
+      if (t1 >= START_TIME) break;
     }
-    level = !level;
   }
+  index_t frame = i;
+  bool level = LOW;
+  i++;
+
+  //-- Recover the bit clock from the preamble
+  micros_t bit = MeasureBitTime(i);
 
   //-- Sample signals at mid-point of data rate
   uint32_t mask = 1ULL<<31;
   uint32_t acc = 0;
-  acc = 0;
-  micros_t t_meas = SAMPLE_RATE/2;
+  micros_t t_meas = bit/2;
   for (t=0; mask; mask >>= 1) {
-    if (t_meas < SAMPLE_RATE) {
-      if (!q.peek(++i, &t)) break;
+    // a pulse shorter than a bit may hold no sample point at all, e.g. one cut
+    // short by a spike the interrupt has not taken back yet; skip over it
+    // rather than let t_meas wrap around
+    while (t_meas < bit) {
+      if (!peek(++i, &t)) break;
       level = !level;
-      t_meas += t;
+      // an idle SPACE lasts for the rest of the word
+      t_meas = t == BIG_IDLE ? BIG_IDLE : t_meas + t;
     }
+    if (t_meas < bit) break;
     acc += !level ? mask : 0;
-    t_meas -= SAMPLE_RATE;
+    t_meas -= bit;
   }
 
-  // ran out of signal before we got whole word
-  if (mask) return 0;
+  // ran out of signal before we got whole word; what came before the frame can go
+  if (mask) {
+    if (frame) consume(frame, changes);
+    return 0;
+  }
 
-  // We decoded a word and it consumed i samples
-  lock _;
-  if (fini == q.tail) {
-    q.drop(i-1);
-  } else {
+  // We decoded a word and it consumed i samples; the last one is the SPACE
+  // after it or its final MARK
+  if (!consume(i, changes)) {
     // race fail; return 0 and let the caller try again later
+    races++;
     acc = 0;
   }
 
   return acc;
 }
 
-bool LogicData::IsValid(uint32_t msg) {
+// Bit period from the preamble pulses following the start-bit at index start;
+// falls back to the nominal rate if they don't look like a preamble
+micros_t IRAM_ATTR LogicData::MeasureBitTime(index_t start) {
+  micros_t sum = 0;
+  micros_t t;
+  for (index_t k = 1; k <= PREAMBLE_PULSES; k++) {
+    if (!peek(start + k, &t)) return SAMPLE_RATE;
+    sum += t;
+  }
+
+  micros_t measured = sum / PREAMBLE_BITS;
+  if (measured < SAMPLE_RATE * 3 / 4 || measured > SAMPLE_RATE * 5 / 4) {
+    return SAMPLE_RATE;
+  }
+  bit_time = measured;
+  return measured;
+}
+
+bool IRAM_ATTR LogicData::IsValid(uint32_t msg) {
   if ((msg & 0xFFF00000) != 0x40600000) {
     return false;
   }
   return CheckParity(msg);
 }
 
-bool LogicData::IsNumber(uint32_t msg) {
+bool IRAM_ATTR LogicData::IsNumber(uint32_t msg) {
   return IsValid(msg) && (msg & 0xFFE00) == 0x00400;
 }
 
+// Known message classes; first match wins. Add new commands here once they
+// are understood, the decoder itself does not need to change.
+struct MsgClass {
+  uint32_t mask;
+  uint32_t value;
+  const char * name;
+};
+
+static constexpr MsgClass msg_classes[] = {
+  { 0xFFE00, 0x00400, "NUMBR" },  // Display number
+  { 0xFFFF,  0x1400,  "DISPL" },  // Display command
+};
+
 const char * LogicData::MsgType(uint32_t msg) {
   if ((msg & 0xFFF00000) != 0x40600000) {
     return "INVAL";
@@ -193,20 +342,24 @@ const char * LogicData::MsgType(uint32_t msg) {
     return "PARIT";
   }
 
-  // Display number
-  if ((msg & 0xFFE00) == 0x00400) {
-    return "NUMBR";
-  }
-
-  // Display command
-  if ((msg & 0xFFFF) == 0x1400) {
-    return "DISPL";
+  for (const MsgClass & c : msg_classes) {
+    if ((msg & c.mask) == c.value) {
+      return c.name;
+    }
   }
 
   return "UKNWN";
 }
 
-static uint8_t ReverseNibble(uint8_t in) {
+bool LogicData::IsKnown(uint32_t msg) {
+  if (!IsValid(msg)) return false;
+  for (const MsgClass & c : msg_classes) {
+    if ((msg & c.mask) == c.value) return true;
+  }
+  return false;
+}
+
+static uint8_t IRAM_ATTR ReverseNibble(uint8_t in) {
   uint8_t ret = 0;
   ret |= (in << 3) & 8;
   ret |= (in << 1) & 4;
@@ -215,7 +368,7 @@ static uint8_t ReverseNibble(uint8_t in) {
   return ret;
 }
 
-static uint8_t ReverseByte(uint8_t in) {
+static uint8_t IRAM_ATTR ReverseByte(uint8_t in) {
   return (ReverseNibble(in) << 4) + ReverseNibble(in>>4);
 }
 
@@ -223,7 +376,7 @@ static uint16_t ReverseWord(uint16_t in) {
   return (ReverseByte(in) << 8) + ReverseByte(in>>8);
 }
 
-uint8_t LogicData::GetNumber(uint32_t msg) {
+uint8_t IRAM_ATTR LogicData::GetNumber(uint32_t msg) {
   if (IsNumber(msg)) {
     return ReverseByte(msg>>1);
   }
@@ -259,94 +412,62 @@ const char * LogicData::Decode(uint32_t msg) {
 }
 
 // Transmit
-void LogicData::SendBit(bool bit) {
-  if(tx_pin != NULL) {
+void IRAM_ATTR LogicData::SendBit(bool bit) {
+  if(tx_pin >= 0) {
     digitalWrite(tx_pin, bit);
   }
 }
 
-void LogicData::MicroDelay(micros_t us) {
-  // spin-wait until timer advances
-  while (true) {
-    Service();
-    micros_t now = micros();
-    now -= timer;
-    if (now >= us) break;
-    // TODO: if (t-now > 50) usleep(t-now-50);
-  }
-  timer += us;
-}
-
-void LogicData::Delay(uint16_t ms) {
-  MicroDelay(micros_t(ms)*1000);
-}
-
-void LogicData::SendBit(bool bit, uint16_t ms) {
-  SendBit(bit);
-  Delay(ms);
-}
-
-void LogicData::Space(uint16_t ms) {
-  SendBit(SPACE, ms);
-}
-
-void LogicData::SendStartBit() {
-  Space(LOGICDATA_MIN_START_BIT);
-}
-
-void LogicData::LogicData::Stop() {
-  SendBit(MARK); // IDLE-CLOSED
-}
-
-void LogicData::Send(uint32_t data) {
-  SendStartBit();
-
-  for (uint32_t i = 0x80000000 ; i; i/=2) {
-    SendBit((i&data)?SPACE:MARK, 1);
-  }
-
-  SendBit(SPACE); // IDLE-OPEN
-}
-
-void LogicData::OpenChannel() {
-  if (active) return;
-  active = true;
-  start = timer = micros();
-  SendBit(SPACE);
-}
-
-void LogicData::CloseChannel() {
-  // Send a SPACE at least long enough so our command-channel was open for 500ms, or
-  // just start-bit length if we've already been open that long.
-
-  if (!active) return;
-
+bool IRAM_ATTR LogicData::SendWord(uint32_t word) {
+  if (!CanSend() || !word) return false;
 
-  // Workaround for stuck timers
-  Stop();
-  return;
-
-  // BUG: Following timers never expire!
-  micros_t delta = timer-start;
-  if (delta/1000 + LOGICDATA_MIN_START_BIT < LOGICDATA_MIN_WINDOW_MS) {
-    timer=start;
-    Space(LOGICDATA_MIN_WINDOW_MS);
-  } else {
-    Space(LOGICDATA_MIN_START_BIT);
-  }
-  Stop();
-
-  active = false;
+  lock _;
+  tx_next = Parity(word & ~1UL);
+  return true;
 }
 
-void LogicData::Send(uint32_t * data, unsigned count) {
-  if (!count) return;
-
-  OpenChannel();
-  for (unsigned i = 0; i != count; i++) {
-    Send(data[i]);
+// One step of the word on the line per call: the start bit, 32 bits MSB
+// first, the stop bit, then a word's gap of idle before the next start bit
+void IRAM_ATTR LogicData::Transmit() {
+  lock _;
+  micros_t now = micros();
+  // the timer interrupt is late by a varying amount, the first tick of a word
+  // included; a tick within half a bit of the step's end is on time
+  if (tx_state != TX_IDLE && int32_t(now - tx_due) < -int32_t(SAMPLE_RATE / 2))
+    return;
+
+  switch (tx_state) {
+    case TX_IDLE:
+      if (!tx_next) return;
+      tx_word = tx_next;
+      tx_next = 0;
+      tx_mask = 0x80000000;
+      SendBit(SPACE); // start bit
+      tx_due = now + micros_t(LOGICDATA_MIN_START_BIT) * 1000;
+      tx_state = TX_DATA;
+      break;
+
+    case TX_DATA:
+      if (tx_mask) {
+        SendBit((tx_word & tx_mask) ? SPACE : MARK);
+        tx_mask >>= 1;
+      } else {
+        SendBit(SPACE); // IDLE-OPEN
+        tx_state = TX_STOP;
+      }
+      tx_due += SAMPLE_RATE;
+      break;
+
+    case TX_STOP:
+      SendBit(MARK); // IDLE-CLOSED
+      tx_due += micros_t(LOGICDATA_MIN_START_BIT) * 1000;
+      tx_state = TX_GAP;
+      break;
+
+    case TX_GAP:
+      tx_state = TX_IDLE;
+      break;
   }
-  CloseChannel();
 }
 
 //
@@ -16,6 +16,9 @@
 // First two bits are always(?) 01 (SPACE MARK)
 // All observed words start with 010000000110 (0x406; SPACE MARK SPACEx7 MARKx2 SPACE)
 
+#ifndef LOGICDATA_H
+#define LOGICDATA_H
+
 #define LOGICDATA_MIN_WINDOW_MS  50 // 500
 #define LOGICDATA_MIN_START_BIT  50
 
@@ -24,21 +27,71 @@
 
 typedef uint32_t micros_t;
 
+// Called from PinChange (interrupts disabled) with every value pushed to the queue,
+// or with GLITCH when the previously pushed value was retracted as noise
+typedef void (*edge_hook_t)(micros_t delta, bool level);
+
 #define TRACE_HISTORY_MAX 80 // powers-of-two are faster in MOD
 #define Q_MAX TRACE_HISTORY_MAX
 
-#define BIG_IDLE (micros_t(-1))         // An eternity
-#define IDLE_TIME (micros_t(1)<<16)     // if the signal is idle for this long, we consider it an eternity
+// Handset command words (parity bit is filled in on the way out). Only words
+// that have been confirmed on a desk should be set; 0 marks a command as
+// unsupported and callers are expected to fall back to the relay pins.
+// Override from pins.h or build_flags once a word has been captured from a
+// real handset; the words are only looked at in the sketch, through
+// CommandWord(), so pins.h reaches them.
+#ifndef LOGICDATA_CMD_STOP
+#define LOGICDATA_CMD_STOP 0
+#endif
+#ifndef LOGICDATA_CMD_UP
+#define LOGICDATA_CMD_UP 0
+#endif
+#ifndef LOGICDATA_CMD_DOWN
+#define LOGICDATA_CMD_DOWN 0
+#endif
+#ifndef LOGICDATA_CMD_MEM1
+#define LOGICDATA_CMD_MEM1 0
+#endif
+#ifndef LOGICDATA_CMD_MEM2
+#define LOGICDATA_CMD_MEM2 0
+#endif
+#ifndef LOGICDATA_CMD_MEM3
+#define LOGICDATA_CMD_MEM3 0
+#endif
+#ifndef LOGICDATA_CMD_MEM4
+#define LOGICDATA_CMD_MEM4 0
+#endif
+
+#define BIG_IDLE (micros_t(-1))         // An eternity; also marks the SPACE before a frame
+#define IDLE_TIME (micros_t(45000))     // SPACE longer than a word at the slowest bit clock: the frame is over
+#define START_TIME (micros_t(40000))    // MARK at least this long is a start-bit
+#define GLITCH (micros_t(-2))           // edge hook only: previous value was retracted
 
+// Pulses shorter than this are relay noise, not data (a bit is 1000us)
+#ifndef LOGICDATA_MIN_PULSE_US
+#define LOGICDATA_MIN_PULSE_US 100
+#endif
 
-// Lock guard; cleans up on exit
+
+// Lock guard; cleans up on exit. Restores the previous interrupt level, so it
+// is also safe to take from interrupt context.
 struct lock {
+#ifdef ESP8266
+  uint32_t ps;
+  lock() {
+      ps = xt_rsil(15);
+  }
+  ~lock() {
+      xt_wsr_ps(ps);
+  }
+#else
   lock() {
       noInterrupts();
   }
   ~lock() {
       interrupts();
   }
+#endif
 };
 
 //--------------------------------------------------
@@ -47,9 +100,15 @@ struct lock {
 typedef uint16_t index_t;
 struct mque {
   // embedded deque; push to head; pop from tail
+  // the interrupt pushes, and moves tail when full, while the loop reads
   micros_t trace[Q_MAX];
-  index_t head = 0;
-  index_t tail = 0;
+  volatile index_t head = 0;
+  volatile index_t tail = 0;
+  volatile uint32_t overruns = 0;  // pushes that dropped the oldest element
+  volatile uint32_t retracts = 0;  // unpushes, which may take back what a reader has seen
+
+  // moves whenever elements a reader has seen may have changed under it
+  uint32_t changes() { return overruns + retracts; }
 
   index_t next(index_t x);
   bool empty();
@@ -62,6 +121,12 @@ struct mque {
   // destructive pop; no-op if empty
   bool pop(micros_t * t);
 
+  // undo the latest push; no-op if empty
+  bool unpush(micros_t * t);
+
+  // overwrite the latest element; no-op if empty
+  void mark(micros_t t);
+
   // drop elements from the tail of the queue; no range-checking!
   void drop(index_t n);
 
@@ -73,33 +138,88 @@ struct mque {
 //
 //--------------------------------------------------
 
+//--------------------------------------------------
+// decoded words, handed from an interrupt-side decoder to the main loop
+//
+#define WORD_Q_MAX 8 // power of two
+
+struct wque {
+  volatile uint32_t words[WORD_Q_MAX];
+  volatile uint8_t head = 0;  // written by the producer only
+  volatile uint8_t tail = 0;  // written by the consumer only
+
+  // drops the word if full; the consumer is expected to keep up
+  bool push(uint32_t w);
+  bool pop(uint32_t * w);
+  bool empty() { return head == tail; }
+};
+
 class LogicData
 {
 //  int rx_pin;
   int tx_pin;
-  bool active = false;
   bool pin_idle = false;
 
-  micros_t timer;  // calculated time of previous step-end
-  micros_t start;  // time of Open()
-
   mque q;
 
+  // Transmit: Service() puts out one step per call, so a word goes out from
+  // the timer interrupt while the loop carries on
+  enum TxState : uint8_t { TX_IDLE, TX_DATA, TX_STOP, TX_GAP };
+  volatile uint32_t tx_next = 0;  // word waiting to go out, 0 for none
+  uint32_t tx_word = 0;           // word on the line
+  uint32_t tx_mask = 0;           // next bit of it
+  micros_t tx_due = 0;            // end of the current step
+  volatile TxState tx_state = TX_IDLE;
+
   micros_t prev_bit = 0;
+  micros_t min_pulse = LOGICDATA_MIN_PULSE_US;
+  uint32_t glitches = 0;
+  uint32_t races = 0;     // words thrown away by ReadTrace because the queue moved under it
+  micros_t bit_time = 0;  // bit period measured from the last preamble
+
+  edge_hook_t edge_hook = nullptr;
+
+  // ReadTrace decodes the elements that were queued when it started;
+  // the interrupt may append more meanwhile. If the line was idle by then,
+  // the SPACE still running counts as a BIG_IDLE after them.
+  index_t avail = 0;
+  bool idle_end = false;
+  bool peek(index_t index, micros_t * t);
+
+  void push(micros_t delta);
+  bool consume(index_t n, uint32_t changes);
+
+  void SendBit(bool bit);
+  void Transmit();
+
+  micros_t MeasureBitTime(index_t start);
 
   public:
 
   enum { SPACE=0, MARK=1 };
 
-  LogicData(int tx) : tx_pin(tx) {}
+  enum Command { CMD_STOP, CMD_UP, CMD_DOWN, CMD_MEM1, CMD_MEM2, CMD_MEM3, CMD_MEM4, CMD_COUNT };
 
-  bool is_active() { return active; }
+  LogicData(int tx) : tx_pin(tx) {}
 
   void Begin();
 
   // Receive
   void PinChange(bool level);
+  // Idle detection; call at least every 10ms, e.g. from a timer interrupt.
+  // Also clocks out what SendWord() queued: while sending, call it every
+  // millisecond (a bit time)
   void Service();
+  void SetEdgeHook(edge_hook_t hook) { edge_hook = hook; }
+
+  // Glitch filter; 0 disables it
+  void SetMinPulse(micros_t us) { min_pulse = us; }
+  uint32_t Glitches() { return glitches; }
+  uint32_t Races() { return races; }
+  micros_t BitTime() { return bit_time; }
+
+  // Replay a captured queue entry as if PinChange had pushed it
+  void Inject(micros_t delta);
 
   uint32_t ReadTrace();
 
@@ -111,6 +231,7 @@ class LogicData
 
   bool IsValid(uint32_t msg);
   bool IsNumber(uint32_t msg);
+  bool IsKnown(uint32_t msg);
   uint8_t GetNumber(uint32_t msg);
 
   // debug: not threadsafe
@@ -121,20 +242,30 @@ class LogicData
     return q.size();
   }
 
-  // Transmit
-  void SendBit(bool bit);
-  void MicroDelay(micros_t us);
-  void Delay(uint16_t ms);
-  void SendBit(bool bit, uint16_t ms);
-  void Space(uint16_t ms=LOGICDATA_MIN_START_BIT);
-  void SendStartBit();
-  void Stop();
-  void Send(uint32_t data);
-  void OpenChannel();
-  void CloseChannel();
-  void Send(uint32_t * data, unsigned count);
+  // Transmit: queue a word, it goes out from Service(). A word queued while
+  // another is on the line replaces any word still waiting after it.
+  bool CanSend() { return tx_pin >= 0; }
+  bool SendWord(uint32_t word);
+  bool Sending() { return tx_state != TX_IDLE || tx_next; }
+
+  // Native handset commands
+  static constexpr uint32_t CommandWord(Command cmd) {
+    return cmd == CMD_STOP ? LOGICDATA_CMD_STOP :
+           cmd == CMD_UP ? LOGICDATA_CMD_UP :
+           cmd == CMD_DOWN ? LOGICDATA_CMD_DOWN :
+           cmd == CMD_MEM1 ? LOGICDATA_CMD_MEM1 :
+           cmd == CMD_MEM2 ? LOGICDATA_CMD_MEM2 :
+           cmd == CMD_MEM3 ? LOGICDATA_CMD_MEM3 :
+           cmd == CMD_MEM4 ? LOGICDATA_CMD_MEM4 : 0;
+  }
+  static constexpr bool HasCommand(Command cmd) { return CommandWord(cmd) != 0; }
+  // Queue a handset command; false if we have no TX pin or the command word
+  // is unknown for this controller
+  bool SendCommand(Command cmd) { return SendWord(CommandWord(cmd)); }
 };
 
 //
 // LOGICDATA protocol
 //////////////////////////////////////////////////////////
+
+#endif // LOGICDATA_H
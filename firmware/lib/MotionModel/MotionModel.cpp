@@ -0,0 +1,63 @@
+#include "MotionModel.h"
+#include <string.h>
+
+static uint16_t blend(uint16_t old, uint32_t sample, uint8_t runs) {
+  return runs ? (3UL * old + sample + 2) / 4 : sample;
+}
+
+void MotionModel::Start(int8_t dir, uint8_t height, uint32_t now) {
+  direction = dir;
+  start_height = height;
+  start_ms = now;
+  first_ms = 0;
+}
+
+void MotionModel::Height(uint8_t height, uint32_t now) {
+  if (!direction)
+    return;
+  if (!first_ms) {
+    if (height == start_height)
+      return;
+    first_height = last_height = height;
+    first_ms = last_ms = now ? now : 1;
+    return;
+  }
+  last_height = height;
+  last_ms = now;
+}
+
+bool MotionModel::Stop() {
+  int8_t dir = direction;
+  direction = 0;
+  int distance = dir * (last_height - first_height);
+  if (!first_ms || distance < MOTION_MIN_RUN_CM || last_ms == first_ms)
+    return false;
+
+  MotionCalibration old = cal;
+  uint32_t mmps = distance * 10000UL / (last_ms - first_ms);
+  if (first_ms - start_ms < 5000)
+    cal.start_ms = blend(cal.start_ms, first_ms - start_ms, cal.up_runs + cal.down_runs);
+  if (dir > 0) {
+    cal.up_mmps = blend(cal.up_mmps, mmps, cal.up_runs);
+    cal.up_runs += cal.up_runs < 255;
+  } else {
+    cal.down_mmps = blend(cal.down_mmps, mmps, cal.down_runs);
+    cal.down_runs += cal.down_runs < 255;
+  }
+  return memcmp(&old, &cal, sizeof(cal)) != 0;
+}
+
+uint32_t MotionModel::TravelMs(uint8_t from, uint8_t to) {
+  if (from == to)
+    return 0;
+  uint16_t mmps = to > from ? cal.up_mmps : cal.down_mmps;
+  uint32_t distance = to > from ? to - from : from - to;
+  return cal.start_ms + (distance - 1) * 10000UL / mmps;
+}
+
+bool MotionModel::Load(const MotionCalibration & c) {
+  if (c.up_mmps < 5 || c.up_mmps > 200 || c.down_mmps < 5 || c.down_mmps > 200 || c.start_ms > 5000)
+    return false;
+  cal = c;
+  return true;
+}
@@ -0,0 +1,64 @@
+//////////////////////////////////////////////////////////
+//
+// Measured motion of the desk
+//
+// Learns how fast the desk moves up and down and how long it takes from
+// driving the motor to the first height change, from the heights reported
+// during ordinary moves. Group moves use it to predict when a move to a
+// given height will arrive.
+//
+// The start latency is measured to the first reported change, so it already
+// includes the first cm; TravelMs() counts the remaining distance only.
+// Runs shorter than MOTION_MIN_RUN_CM are not measured. The first measured
+// run in a direction replaces the default, every later one moves the
+// calibration a quarter of the way towards what it measured.
+//
+
+#ifndef MOTION_MODEL_H
+#define MOTION_MODEL_H
+
+#include <stdint.h>
+
+#define MOTION_MIN_RUN_CM 5
+#define MOTION_DEFAULT_MMPS 38      // about what a LogicData desk does
+#define MOTION_DEFAULT_START_MS 500
+
+struct MotionCalibration {
+  uint16_t up_mmps;
+  uint16_t down_mmps;
+  uint16_t start_ms;
+  uint8_t up_runs;    // measured so far, up to 255
+  uint8_t down_runs;
+};
+
+class MotionModel
+{
+  int8_t direction = 0;   // of the run being measured, 0 if none
+  uint8_t start_height;
+  uint32_t start_ms;
+  uint8_t first_height;
+  uint32_t first_ms = 0;  // 0 until the height changed
+  uint8_t last_height;
+  uint32_t last_ms;
+
+  public:
+
+  MotionCalibration cal = {MOTION_DEFAULT_MMPS, MOTION_DEFAULT_MMPS, MOTION_DEFAULT_START_MS, 0, 0};
+
+  // The motor is driven from height in direction (1 up, -1 down)
+  void Start(int8_t direction, uint8_t height, uint32_t now);
+
+  // A height was reported
+  void Height(uint8_t height, uint32_t now);
+
+  // The motor was released; returns true if the calibration changed
+  bool Stop();
+
+  // Time from driving the motor at from until to is reported
+  uint32_t TravelMs(uint8_t from, uint8_t to);
+
+  // Adopt a stored calibration, if it is plausible
+  bool Load(const MotionCalibration & c);
+};
+
+#endif // MOTION_MODEL_H
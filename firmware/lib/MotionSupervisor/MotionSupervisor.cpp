@@ -0,0 +1,70 @@
+#include "MotionSupervisor.h"
+
+bool MotionSupervisor::Arm(int8_t dir, uint32_t now) {
+  lock _;
+  if (fault != NONE) return false;
+  if (direction != dir) {
+    progress_ms = now;
+  }
+  heartbeat_ms = now;
+  direction = dir;
+  return true;
+}
+
+void IRAM_ATTR MotionSupervisor::Height(uint8_t h, uint32_t now) {
+  lock _;
+  height = h;
+  progress_ms = now;
+}
+
+MotionSupervisor::Fault MotionSupervisor::TakeFault() {
+  lock _;
+  Fault f = fault;
+  fault = NONE;
+  return f;
+}
+
+const char * MotionSupervisor::FaultName(Fault f) {
+  switch (f) {
+    case STALL: return "stall";
+    case LIMIT: return "limit";
+    case LOOP_HUNG: return "loop";
+    case TARGET: return "target";
+    default: return "none";
+  }
+}
+
+bool IRAM_ATTR MotionSupervisor::Check(uint32_t now) {
+  if (!direction) return false;
+
+  Fault f = NONE;
+  if (now - heartbeat_ms > loop_ms) {
+    f = LOOP_HUNG;
+  } else if (now - progress_ms > stall_ms) {
+    f = STALL;
+  } else if (height && ((direction > 0 && height > max_height) ||
+                        (direction < 0 && height < min_height))) {
+    f = LIMIT;
+  }
+
+  if (f == NONE) return false;
+
+  direction = 0;
+  fault = f;
+  return true;
+}
+
+bool IRAM_ATTR MotionSupervisor::Reached(uint8_t h, uint32_t now) {
+  Height(h, now);
+
+  uint16_t tw = target_word;
+  int8_t dir = int8_t(tw >> 8);
+  uint8_t target = tw & 0xFF;
+  if (!direction || !dir) return false;
+  if ((dir > 0 && h < target) || (dir < 0 && h > target)) return false;
+
+  direction = 0;
+  target_word = 0;
+  fault = TARGET;
+  return true;
+}
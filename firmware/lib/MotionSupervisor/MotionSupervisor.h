@@ -0,0 +1,67 @@
+//////////////////////////////////////////////////////////
+//
+// Motion safety supervisor
+//
+// Runs from a hardware timer interrupt, independent of loop(). While the
+// motor is driven it trips when the decoded height stops changing, a height
+// limit is passed or loop() stops checking in; the caller then drops the
+// motor pins straight from the interrupt. The worst-case stop latency is the
+// timeout of the condition plus one timer period.
+//
+// With an interrupt-side decoder it also stops the motor the moment a
+// decoded height reaches the published target (Reached), so stopping
+// precision does not depend on loop() latency.
+//
+
+#ifndef MOTION_SUPERVISOR_H
+#define MOTION_SUPERVISOR_H
+
+#include <stdint.h>
+#include "Arduino.h"
+#include <LogicData.h>
+
+#ifndef SUPERVISOR_PERIOD_US
+#define SUPERVISOR_PERIOD_US 10000  // timer period
+#endif
+#define SUPERVISOR_STALL_MS 2000    // no height change while moving
+#define SUPERVISOR_LOOP_MS 500      // loop() did not check in while moving
+
+class MotionSupervisor
+{
+  volatile int8_t direction = 0;      // 1 up, -1 down, 0 not driven
+  volatile uint8_t height = 0;        // 0 is unknown
+  volatile uint32_t progress_ms = 0;  // last height change or start of motion
+  volatile uint32_t heartbeat_ms = 0;
+  volatile uint16_t target_word = 0;  // direction << 8 | height, published in one store
+
+  public:
+
+  // Why the motor was stopped; TARGET is a regular stop, not a fault
+  enum Fault : uint8_t { NONE, STALL, LIMIT, LOOP_HUNG, TARGET };
+
+  volatile Fault fault = NONE;
+  uint8_t min_height = 0;
+  uint8_t max_height = 255;
+  uint32_t stall_ms = SUPERVISOR_STALL_MS;
+  uint32_t loop_ms = SUPERVISOR_LOOP_MS;
+
+  // Main loop side; Arm fails while a stop is pending, so the motor is not
+  // driven again before loop() has handled it
+  bool Arm(int8_t dir, uint32_t now);
+  void Disarm() { direction = 0; }
+  bool Armed() { return direction != 0; }
+  void Height(uint8_t h, uint32_t now);
+  void Heartbeat(uint32_t now) { heartbeat_ms = now; }
+  void SetTarget(uint8_t h, int8_t dir) { target_word = uint16_t(uint8_t(dir)) << 8 | h; }
+  void ClearTarget() { target_word = 0; }
+
+  // Returns and clears the latched fault
+  Fault TakeFault();
+  static const char * FaultName(Fault f);
+
+  // Timer side: return true if the motor must be stopped now
+  bool Check(uint32_t now);
+  bool Reached(uint8_t h, uint32_t now);
+};
+
+#endif // MOTION_SUPERVISOR_H
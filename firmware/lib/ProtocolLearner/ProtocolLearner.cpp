@@ -0,0 +1,48 @@
+#include "ProtocolLearner.h"
+#include <string.h>
+
+uint16_t ProtocolLearner::hash(uint32_t word) {
+  // Fibonacci hashing; words differ mostly in their low bits
+  return (uint32_t)(word * 2654435761u) >> 16 & (LEARN_TABLE_SIZE - 1);
+}
+
+void ProtocolLearner::Clear() {
+  memset(table, 0, sizeof(table));
+  used = 0;
+  dropped = 0;
+}
+
+bool ProtocolLearner::Record(uint32_t word, uint32_t now) {
+  if (!word) return false;
+
+  uint16_t slot = hash(word);
+  for (uint16_t probe = 0; probe < LEARN_TABLE_SIZE; probe++) {
+    LearnedWord & e = table[slot];
+    if (e.word == word) {
+      e.count++;
+      e.last_seen = now;
+      return true;
+    }
+    if (!e.word) {
+      e.word = word;
+      e.count = 1;
+      e.first_seen = e.last_seen = now;
+      used++;
+      return true;
+    }
+    slot = (slot + 1) & (LEARN_TABLE_SIZE - 1);
+  }
+
+  dropped++;
+  return false;
+}
+
+bool ProtocolLearner::Get(uint16_t & index, LearnedWord & out) {
+  for (; index < LEARN_TABLE_SIZE; index++) {
+    if (table[index].word) {
+      out = table[index++];
+      return true;
+    }
+  }
+  return false;
+}
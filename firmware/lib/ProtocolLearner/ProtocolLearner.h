@@ -0,0 +1,50 @@
+//////////////////////////////////////////////////////////
+//
+// Protocol learning mode
+//
+// Keeps a histogram of distinct LogicData words in a fixed-size
+// open-addressing hash table, so unknown parts of the protocol can be
+// mapped from live traffic without logging every word.
+//
+
+#ifndef PROTOCOL_LEARNER_H
+#define PROTOCOL_LEARNER_H
+
+#include <stdint.h>
+
+#define LEARN_TABLE_SIZE 64 // must be a power of two
+
+struct LearnedWord {
+  uint32_t word;        // 0 marks an empty slot; valid words never are 0
+  uint32_t count;
+  uint32_t first_seen;  // millis()
+  uint32_t last_seen;   // millis()
+};
+
+class ProtocolLearner
+{
+  LearnedWord table[LEARN_TABLE_SIZE];
+  uint16_t used = 0;
+  uint32_t dropped = 0;  // words we had no room for
+
+  static uint16_t hash(uint32_t word);
+
+  public:
+
+  bool enabled = false;
+
+  ProtocolLearner() { Clear(); }
+
+  void Clear();
+
+  // Count an occurrence of word; returns false if the table is full
+  bool Record(uint32_t word, uint32_t now);
+
+  uint16_t Used() { return used; }
+  uint32_t Dropped() { return dropped; }
+
+  // Iterate over the occupied slots; returns false once index is past the end
+  bool Get(uint16_t & index, LearnedWord & out);
+};
+
+#endif // PROTOCOL_LEARNER_H
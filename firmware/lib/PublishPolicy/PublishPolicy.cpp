@@ -0,0 +1,37 @@
+#include "PublishPolicy.h"
+
+void PublishPolicy::Track(bool moving) {
+  if (moving)
+    stop_pending = false;
+  else if (was_moving)
+    stop_pending = true;
+  was_moving = moving;
+}
+
+bool PublishPolicy::Due(uint32_t now, uint8_t height, bool moving) {
+  Track(moving);
+  if (!height)
+    return false;
+
+  uint32_t since = now - last;
+  int change = height > published ? height - published : published - height;
+  bool due;
+  if (!published)
+    due = true;
+  else if (moving)
+    due = change >= PUBLISH_CHANGE_CM && since >= PUBLISH_MOVING_MS;
+  else if (stop_pending) {
+    due = change > 0;
+    stop_pending = false;
+  }
+  else
+    due = (change > 0 && since >= PUBLISH_IDLE_MS) || since >= PUBLISH_HEARTBEAT_MS;
+
+  if (due) {
+    published = height;
+    last = now;
+    stop_pending = false;
+    publishes++;
+  }
+  return due;
+}
@@ -0,0 +1,54 @@
+//////////////////////////////////////////////////////////
+//
+// When to publish the height
+//
+// While the table moves the height is published at most every
+// PUBLISH_MOVING_MS, once it changed by PUBLISH_CHANGE_CM. The height the
+// table stops at goes out right away. At rest a change is published at most
+// every PUBLISH_IDLE_MS, and an unchanged height is repeated every
+// PUBLISH_HEARTBEAT_MS, so a silent desk can be told from a quiet one.
+//
+// A stop is latched until it has been looked at by Due(), so one that
+// happens while there is nobody to publish to still goes out afterwards.
+//
+
+#ifndef PUBLISH_POLICY_H
+#define PUBLISH_POLICY_H
+
+#include <stdint.h>
+
+#ifndef PUBLISH_MOVING_MS
+#define PUBLISH_MOVING_MS 250
+#endif
+#ifndef PUBLISH_CHANGE_CM
+#define PUBLISH_CHANGE_CM 1
+#endif
+#ifndef PUBLISH_IDLE_MS
+#define PUBLISH_IDLE_MS 1000
+#endif
+#ifndef PUBLISH_HEARTBEAT_MS
+#define PUBLISH_HEARTBEAT_MS 60000
+#endif
+
+class PublishPolicy
+{
+  uint8_t published = 0;  // 0: nothing published yet
+  uint32_t last = 0;      // millis() of the last publish
+  bool was_moving = false;
+  bool stop_pending = false;  // stopped since the last Due()
+
+  public:
+
+  uint32_t publishes = 0;
+
+  // Whether to publish height now; if so it counts as published
+  bool Due(uint32_t now, uint8_t height, bool moving);
+
+  // Follow the motion without publishing, e.g. while disconnected
+  void Track(bool moving);
+
+  // Publish again on the next call, e.g. after a reconnect
+  void Invalidate() { published = 0; }
+};
+
+#endif // PUBLISH_POLICY_H
@@ -0,0 +1,158 @@
+#include "SessionRecorder.h"
+#include <EdgeCapture.h>
+#include <string.h>
+
+#define SESSION_MASK (SESSION_BUFFER_SIZE - 1)
+
+struct session_lock {
+  session_lock() { noInterrupts(); }
+  ~session_lock() { interrupts(); }
+};
+
+void SessionRecorder::Start() {
+  session_lock _;
+  head = tail = 0;
+  events = overruns = 0;
+  lost = false;
+  buttons = 0;
+  last_us = micros();
+  active = true;
+
+  uint8_t tmp[5];
+  put(SESSION_START, tmp, EdgeCapture::Encode(millis(), tmp));
+}
+
+void SessionRecorder::Stop() {
+  active = false;
+}
+
+void IRAM_ATTR SessionRecorder::put(uint8_t tag, const uint8_t * payload, size_t len) {
+  uint8_t hdr[1 + 5];
+  uint32_t now = micros();
+
+  if (lost) {
+    // Announce the gap first; if even that does not fit, keep waiting
+    hdr[0] = SESSION_GAP;
+    size_t n = 1 + EdgeCapture::Encode(now - last_us, hdr + 1);
+    if (SESSION_BUFFER_SIZE - (head - tail) < n) {
+      overruns++;
+      return;
+    }
+    for (size_t i = 0; i < n; i++) buf[(head + i) & SESSION_MASK] = hdr[i];
+    head += n;
+    last_us = now;
+    lost = false;
+  }
+
+  hdr[0] = tag;
+  size_t n = 1 + EdgeCapture::Encode(now - last_us, hdr + 1);
+  if (SESSION_BUFFER_SIZE - (head - tail) < n + len) {
+    overruns++;
+    lost = true;
+    return;
+  }
+
+  uint32_t h = head;
+  for (size_t i = 0; i < n; i++) buf[h++ & SESSION_MASK] = hdr[i];
+  for (size_t i = 0; i < len; i++) buf[h++ & SESSION_MASK] = payload[i];
+  head = h;
+  last_us = now;
+  events++;
+}
+
+void IRAM_ATTR SessionRecorder::Edge(bool level) {
+  // Assumes interrupts disabled (called from the pin ISR)
+  if (!active) return;
+  put(level ? SESSION_EDGE_HIGH : SESSION_EDGE_LOW, nullptr, 0);
+}
+
+void SessionRecorder::Button(uint8_t index, bool level) {
+  if (!active || index >= SESSION_BUTTONS) return;
+  uint8_t bit = 1 << index;
+  if (!(buttons & bit) == !level) return;
+  buttons ^= bit;
+
+  uint8_t value = index << 1 | level;
+  session_lock _;
+  put(SESSION_BUTTON, &value, 1);
+}
+
+void SessionRecorder::Message(const char * topic, const uint8_t * payload, unsigned int length) {
+  if (!active) return;
+
+  uint8_t tmp[SESSION_MAX_RECORD];
+  size_t topic_len = strlen(topic);
+  if (topic_len + length + 10 > sizeof(tmp)) {
+    session_lock _;
+    overruns++;
+    lost = true;
+    return;
+  }
+
+  size_t n = EdgeCapture::Encode(topic_len, tmp);
+  memcpy(tmp + n, topic, topic_len);
+  n += topic_len;
+  n += EdgeCapture::Encode(length, tmp + n);
+  memcpy(tmp + n, payload, length);
+  n += length;
+
+  session_lock _;
+  put(SESSION_MQTT, tmp, n);
+}
+
+size_t SessionRecorder::ReadFrame(uint8_t * out) {
+  uint32_t avail = head - tail;
+  if (!avail) return 0;
+  if (avail > SESSION_CHUNK_SIZE) avail = SESSION_CHUNK_SIZE;
+
+  out[0] = SESSION_FRAME_MAGIC;
+  out[1] = seq++;
+  out[2] = avail & 0xFF;
+  out[3] = avail >> 8;
+  for (uint32_t i = 0; i < avail; i++) {
+    out[SESSION_FRAME_HEADER + i] = buf[(tail + i) & SESSION_MASK];
+  }
+  tail += avail;
+  return SESSION_FRAME_HEADER + avail;
+}
+
+size_t SessionRecorder::Parse(const uint8_t * in, size_t len, SessionRecord & r) {
+  if (!len) return 0;
+  memset(&r, 0, sizeof(r));
+  r.tag = in[0];
+
+  size_t off = 1;
+  size_t n = EdgeCapture::Decode(in + off, len - off, r.dt);
+  if (!n) return 0;
+  off += n;
+
+  switch (r.tag) {
+    case SESSION_START:
+      n = EdgeCapture::Decode(in + off, len - off, r.value);
+      if (!n) return 0;
+      return off + n;
+
+    case SESSION_EDGE_LOW:
+    case SESSION_EDGE_HIGH:
+    case SESSION_GAP:
+      return off;
+
+    case SESSION_BUTTON:
+      if (off >= len) return 0;
+      r.value = in[off];
+      return off + 1;
+
+    case SESSION_MQTT:
+      n = EdgeCapture::Decode(in + off, len - off, r.topic_len);
+      if (!n || off + n + r.topic_len > len) return 0;
+      off += n;
+      r.topic = (const char *)in + off;
+      off += r.topic_len;
+      n = EdgeCapture::Decode(in + off, len - off, r.payload_len);
+      if (!n || off + n + r.payload_len > len) return 0;
+      off += n;
+      r.payload = in + off;
+      return off + r.payload_len;
+  }
+  return 0;
+}
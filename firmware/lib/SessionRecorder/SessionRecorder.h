@@ -0,0 +1,89 @@
+//////////////////////////////////////////////////////////
+//
+// Session recorder
+//
+// Records every input the firmware reacts to - LogicData pin edges, button
+// levels and incoming MQTT messages - with their micros() spacing, so a
+// session from a real desk can be replayed on the host under a virtual
+// clock (tools/session_replay.cpp).
+//
+// Records are: tag (uint8), varint us since the previous record, payload
+//   SESSION_START   varint millis() at start
+//   SESSION_EDGE_*  -
+//   SESSION_BUTTON  uint8 (button index << 1 | pin level)
+//   SESSION_MQTT    varint topic length, topic, varint length, payload
+//   SESSION_GAP     -  (records were lost; replay is not exact past this)
+//
+// The stream is sent in frames like EdgeCapture, with magic 'S'.
+//
+
+#ifndef SESSION_RECORDER_H
+#define SESSION_RECORDER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "Arduino.h"
+
+#define SESSION_BUFFER_SIZE 8192 // must be a power of two
+#define SESSION_CHUNK_SIZE 128
+#define SESSION_FRAME_MAGIC 'S'
+#define SESSION_FRAME_HEADER 4
+#define SESSION_MAX_RECORD 300   // larger MQTT messages are dropped as a gap
+#define SESSION_BUTTONS 8
+
+enum SessionTag : uint8_t {
+  SESSION_START = 1,
+  SESSION_EDGE_LOW,
+  SESSION_EDGE_HIGH,
+  SESSION_BUTTON,
+  SESSION_MQTT,
+  SESSION_GAP,
+};
+
+struct SessionRecord {
+  uint8_t tag;
+  uint32_t dt;             // us since the previous record
+  uint32_t value;          // START: millis, BUTTON: index << 1 | level
+  const char * topic;      // MQTT only; not terminated
+  uint32_t topic_len;
+  const uint8_t * payload; // MQTT only
+  uint32_t payload_len;
+};
+
+class SessionRecorder
+{
+  uint8_t buf[SESSION_BUFFER_SIZE];
+  volatile uint32_t head = 0;
+  volatile uint32_t tail = 0;
+  uint32_t last_us = 0;
+  bool lost = false;
+  uint8_t buttons = 0;  // last recorded level per button
+  uint8_t seq = 0;
+
+  // Append one record; caller must hold interrupts off
+  void put(uint8_t tag, const uint8_t * payload, size_t len);
+
+  public:
+
+  volatile bool active = false;
+  uint32_t events = 0;
+  uint32_t overruns = 0;
+
+  void Start();
+  void Stop();
+
+  // ISR side
+  void Edge(bool level);
+
+  // Main loop side; Button only records level changes
+  void Button(uint8_t index, bool level);
+  void Message(const char * topic, const uint8_t * payload, unsigned int length);
+
+  uint32_t Available() { return head - tail; }
+  size_t ReadFrame(uint8_t * out);
+
+  // Host side: parse one record; returns bytes consumed, 0 if truncated or unknown
+  static size_t Parse(const uint8_t * in, size_t len, SessionRecord & r);
+};
+
+#endif // SESSION_RECORDER_H
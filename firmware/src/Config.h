@@ -0,0 +1,87 @@
+//////////////////////////////////////////////////////////
+//
+// Build configuration
+//
+// Everything the firmware is built with is known at compile time: the
+// credentials, the network setup and which subsystems are in at all.
+//
+// Feature switches are 0 or 1; set them with build_flags, e.g.
+// `-D ENABLE_OTA=0` or `-D ENABLE_CAPTURE` (which means 1). A subsystem that
+// is switched off is not compiled in - no code, no buffers, no library:
+//
+// - ENABLE_MQTT            broker connection, topics and group moves; without it
+//                          the desk only follows buttons (and the local endpoint)
+// - ENABLE_OTA             updates over the air
+// - ENABLE_TELEMETRY       protocol learner, height history and the stats command
+// - ENABLE_LOCAL_ENDPOINT  raw TCP control on LOCAL_PORT, see LocalEndpoint.h
+// - ENABLE_CAPTURE         raw LogicData edge capture to MQTT (or Serial)
+// - ENABLE_SESSION_RECORD  recording of all inputs to MQTT for host replay
+//
+// Credentials.h and Wificonfig.h (rename the .example files) hold macros, so
+// the values end up in the Config struct below and topic names are string
+// literals put together by the compiler: TOPIC("set") is MQTT_TOPIC "set".
+//
+
+#ifndef CONFIG_H
+#define CONFIG_H
+
+#include <stdint.h>
+
+#ifndef ENABLE_MQTT
+#define ENABLE_MQTT 1
+#endif
+#ifndef ENABLE_OTA
+#define ENABLE_OTA 1
+#endif
+#ifndef ENABLE_TELEMETRY
+#define ENABLE_TELEMETRY 1
+#endif
+#ifndef ENABLE_LOCAL_ENDPOINT
+#define ENABLE_LOCAL_ENDPOINT 0
+#endif
+#ifndef ENABLE_CAPTURE
+#define ENABLE_CAPTURE 0
+#endif
+#ifndef ENABLE_SESSION_RECORD
+#define ENABLE_SESSION_RECORD 0
+#endif
+
+#if ENABLE_SESSION_RECORD && !ENABLE_MQTT
+#error "ENABLE_SESSION_RECORD streams to MQTT, it needs ENABLE_MQTT"
+#endif
+
+#include <Credentials.h> // rename Credentials.h.example and adjust the values
+#include <Wificonfig.h>  // optional static IP, rename Wificonfig.h.example
+
+#ifndef MQTT_TOPIC
+#error "Credentials.h defines variables; it takes macros now, see Credentials.h.example"
+#endif
+
+// the old Wificonfig.h had the same include guard, but not the marker
+#if defined(WIFICONFIG_H) && !defined(WIFICONFIG_MACROS)
+#error "Wificonfig.h defines IPAddress variables; it takes macros now, see Wificonfig.h.example"
+#endif
+
+#define TOPIC(name) MQTT_TOPIC name
+
+struct Config {
+  static constexpr const char * wifi_ssid = WIFI_SSID;
+  static constexpr const char * wifi_psk = WIFI_PSK;
+  static constexpr const char * mqtt_broker = MQTT_BROKER;
+  static constexpr uint16_t mqtt_port = MQTT_PORT;
+  static constexpr const char * mqtt_user = MQTT_USER;
+  static constexpr const char * mqtt_pass = MQTT_PASS;
+
+#ifdef WIFI_IP
+  static constexpr bool static_ip = true;
+  static constexpr uint8_t ip[4] = {WIFI_IP};
+  static constexpr uint8_t gateway[4] = {WIFI_GATEWAY};
+  static constexpr uint8_t subnet[4] = {WIFI_SUBNET};
+  static constexpr uint8_t dns[4] = {WIFI_DNS};
+#else
+  static constexpr bool static_ip = false;
+  static constexpr uint8_t ip[4] = {}, gateway[4] = {}, subnet[4] = {}, dns[4] = {};
+#endif
+};
+
+#endif // CONFIG_H
@@ -1,16 +1,78 @@
 #include <pins.h> // rename pins.h.example and adjust pins
-#include <LogicData.h>
 #include <ESP8266WiFi.h>
+#include "Config.h"
+#include <LogicData.h>
+#include <FastPin.h>
+#if ENABLE_TELEMETRY
+#include <ProtocolLearner.h>
+#endif
+#include <DeskState.h>
+#include <CommandCoalescer.h>
+#include <CommandQueue.h>
+#include <Backoff.h>
+#include <MotionModel.h>
+#include <DutyCycle.h>
+#include <PublishPolicy.h>
+#if ENABLE_TELEMETRY
+#include <HeightHistory.h>
+#endif
+#if defined(ISR_TARGET_STOP) || defined(LOGICDATA_TX)
+#define SUPERVISOR_PERIOD_US 1000 // the timer also decodes words or clocks out handset commands, once a bit time
+#endif
+#include <MotionSupervisor.h>
+#if ENABLE_CAPTURE
+#include <EdgeCapture.h>
+#endif
+#if ENABLE_SESSION_RECORD
+#include <SessionRecorder.h>
+#endif
+#if ENABLE_LOCAL_ENDPOINT
+#include <LocalEndpoint.h>
+#endif
+#if ENABLE_MQTT
 #include <PubSubClient.h>
+#endif
+#if ENABLE_OTA
 #include <ArduinoOTA.h>
-#include <Credentials.h> // rename Credential.h.example and adjust variables
+#endif
 #include <Logging.h>
-#include <Wificonfig.h>
+#include <time.h>
+#include <sys/time.h>
+#include <coredecls.h>
 
 uint8_t highTarget = 125;
 uint8_t lowTarget = 88;
 uint8_t maxHeight = 128; //maxHeight table = 128, but you may set a custom min
 uint8_t minHeight = 78; //minHeight table = 62, but you may set a custom min
+const uint8_t tableMax = 128;
+const uint8_t tableMin = 62;
+
+//pins used from interrupts and on every motor change, written through the GPIO registers
+typedef FastPin<LOGICDATA_RX> logicDataPin;
+typedef FastPin<ASSERT_UP> assertUpPin;
+typedef FastPin<ASSERT_DOWN> assertDownPin;
+//the targets and limits above are defaults, the flash store keeps changes made at runtime
+
+//keys of the records in the flash store
+#define PRESET_COUNT 4
+enum StoreKey : uint8_t { KEY_DESK_STATE, KEY_SETTINGS, KEY_PRESET1, KEY_MOTION = KEY_PRESET1 + PRESET_COUNT };
+
+//group moves: every desk subscribed to the group topic starts, or arrives, at the same time
+#ifndef MQTT_GROUP_TOPIC
+#define MQTT_GROUP_TOPIC "robodesk/group"
+#endif
+#ifndef NTP_SERVER
+#define NTP_SERVER "pool.ntp.org"
+#endif
+const int32_t group_max_lead = 60000; // furthest ahead a desk schedules its part of a group move
+
+#if ENABLE_OTA
+//OTA progress is logged in this many steps, not for every chunk; gzipped images (tools/ota_pack) are taken as well
+#ifndef OTA_PROGRESS_STEPS
+#define OTA_PROGRESS_STEPS 10
+#endif
+uint8_t ota_step = 0;
+#endif
 
 const uint32_t debounce_time = 50;
 const uint32_t double_time = 500;
@@ -29,13 +91,102 @@ uint32_t btn_last_on[BTN_COUNT] = {0};
 uint32_t last_signal = 0;
 uint32_t signal_giveup_time = 2000;
 
-long lastPublish = 0;
-uint8_t publishedHeight = 0;
+//in transmit mode the handset command is repeated while moving, like a held button
+uint32_t command_repeat_time = 200;
+uint32_t last_command = 0;
 
-const char* versionLine = "Robodesk v3.0  build: " __DATE__ " " __TIME__;
+//flash is only written once the table has been at rest this long
+uint32_t persist_delay = 5000;
+
+//while idle the loop naps until an interrupt, network data or the nap time is up;
+//after an edge or a button change it stays awake for a while to see words and debouncing through
+#ifndef IDLE_NAP_MS
+#define IDLE_NAP_MS 100
+#endif
+#ifndef IDLE_SLEEP_MODE
+#define IDLE_SLEEP_MODE WIFI_MODEM_SLEEP // light sleep would stop timer1 and the edge timing of the decoder
+#endif
+const uint32_t idle_holdoff = 50;
+volatile bool wakeup = false;
+volatile uint32_t last_wakeup = 0;
+
+#if ENABLE_MQTT
+PublishPolicy heightPolicy;
+
+//the retained snapshot in <MQTT_TOPIC>snapshot, published when one of its fields changed
+struct Snapshot {
+  uint8_t height;
+  uint8_t target;     // 0 when not moving to a target
+  int8_t direction;   // 1 up, -1 down, 0 stopped
+  uint8_t min, max, low, high;
+  bool fault;
+  uint32_t stats_gen; // bumped when the diagnostic counters moved
+};
+Snapshot published_snapshot;
+bool snapshot_valid = false; // published_snapshot is on the broker
+uint32_t snapshot_time = 0;
+uint32_t stats_gen = 0;
+uint32_t stats_sum = 0;
+const uint32_t snapshot_min_time = 250;    // between snapshots while things change
+const uint32_t snapshot_stats_time = 10000; // between snapshots for counters alone
+#endif
+
+#define ROBODESK_VERSION "3.0"
+const char* versionLine = "Robodesk v" ROBODESK_VERSION "  build: " __DATE__ " " __TIME__;
+#ifdef LOGICDATA_TX
+#if !LOGICDATA_CMD_STOP
+#error "LOGICDATA_TX needs LOGICDATA_CMD_STOP: without it nothing can stop a desk driven by handset commands"
+#endif
+LogicData logicData(LOGICDATA_TX);
+#else
 LogicData logicData(-1);
+#endif
+#if ENABLE_TELEMETRY
+ProtocolLearner learner;
+HeightHistory history;
+#endif
+MotionSupervisor supervisor;
+FlashLog store;
+DeskStateStore deskState;
+CommandCoalescer setCommands;
+CommandQueue commands;
+MotionModel motion;
+DutyCycle duty;
+#ifdef ISR_TARGET_STOP
+//words decoded by the timer interrupt, consumed by check_display()
+wque decoded;
+#endif
+#if ENABLE_CAPTURE
+EdgeCapture capture;
+#endif
+#if ENABLE_SESSION_RECORD
+SessionRecorder session;
+#endif
+#if ENABLE_LOCAL_ENDPOINT
+LocalEndpoint local;
+#endif
+#if ENABLE_MQTT
 WiFiClient espClient;
 PubSubClient mqttClient(espClient);
+//one connect attempt per loop at most, backing off so a fleet of desks does not storm a restarted broker
+Backoff mqttBackoff(1000, 60000);
+//unique per desk: brokers drop the older session of two clients with the same id
+char mqttClientId[20];
+bool mqttConnected = false;
+
+//everything outside the MQTT functions publishes through these, they compile to nothing without MQTT
+bool mqtt_connected() { return mqttClient.connected(); }
+bool mqtt_publish(const char * topic, const char * payload, bool retained = false) {
+  return mqttClient.publish(topic, payload, retained);
+}
+bool mqtt_publish(const char * topic, const uint8_t * payload, unsigned int length, bool retained) {
+  return mqttClient.publish(topic, payload, length, retained);
+}
+#else
+inline bool mqtt_connected() { return false; }
+inline bool mqtt_publish(const char *, const char *, bool = false) { return false; }
+inline bool mqtt_publish(const char *, const uint8_t *, unsigned int, bool) { return false; }
+#endif
 
 uint8_t currentHeight;
 uint8_t targetHeight;
@@ -43,22 +194,13 @@ bool setHeight = false;
 enum Directions { UP, DOWN, STOPPED };
 Directions direction = STOPPED;
 bool mqttLog = false;
+//set when the supervisor stopped the table; motion stays blocked until the buttons are released or a new command arrives
+bool safety_latched = false;
+//both buttons are held; the position was saved for this press
+bool both_pressed = false;
 
 #pragma region Helpers
 
-template <class T>
-/**
- * @brief Converts anything to char *
- * 
- * @param value 
- * @return char* 
- */
-char * convertToChar (T value) {
-    String valueString = String(value);
-    char * output = new char[valueString.length() +1];
-    strcpy(output,valueString.c_str());
-    return output;
-}
 int convertCharToInt (char* value, int length) {
   value[length] = '\0';
   return atoi(value);
@@ -87,6 +229,243 @@ bool isValidHeight(int checkHeight, Directions direction = STOPPED) {
   }
 }
 
+/**
+ * @brief Current direction as 1 up, -1 down, 0 stopped
+ */
+int8_t direction_sign() {
+  return direction == UP ? 1 : direction == DOWN ? -1 : 0;
+}
+
+/**
+ * @brief Starts moving to a target height from loop() (setHeight-mode)
+ * 
+ * @param target height in cm
+ */
+void set_target(uint8_t target) {
+  targetHeight = target;
+  setHeight = true;
+  safety_latched = false;
+  // the controller is silent while idle, start counting from the command
+  last_signal = millis();
+}
+
+/**
+ * @brief Wall clock time from SNTP
+ * 
+ * @return Unix time in ms, 0 until the clock has been set
+ */
+uint64_t epoch_ms() {
+  struct timeval tv;
+  gettimeofday(&tv, nullptr);
+  if (tv.tv_sec < 1600000000)
+    return 0;
+  return tv.tv_sec * 1000ULL + tv.tv_usec / 1000;
+}
+
+#pragma endregion
+
+#pragma region Desk state
+
+DeskState current_state() {
+  DeskState s = {currentHeight, highTarget, lowTarget,
+                 direction_sign()};
+  return s;
+}
+
+/**
+ * @brief Mirrors height, targets and direction into RTC memory,
+ *        so a warm reset can pick up where we were
+ * 
+ */
+void save_state() {
+  deskState.Save(current_state());
+}
+
+/**
+ * @brief Hands the state to the flash store and lets the store write, one record
+ *        or sector erase per loop pass, once the table has been at rest for a while.
+ *        Writing flash stalls the CPU, so never while the table moves.
+ * 
+ */
+void persist_state() {
+  if (direction != STOPPED || setHeight || millis() - last_signal < persist_delay)
+    return;
+  // nor while a group move waits for its start
+  const QueueStep * step = commands.Current();
+  if (step && step->kind == STEP_WAIT_MS)
+    return;
+  if (currentHeight)
+    deskState.Persist(current_state());
+  uint32_t failures = store.failures;
+  bool touched = store.Service();
+  if (store.failures != failures)
+    Log.Error(store.Ready() ? "Could not write the store to flash, retrying" CR
+                            : "The flash store stopped writing, settings are kept until the next reset only" CR);
+  if (touched)
+    return;
+
+#if ENABLE_TELEMETRY
+  // the history goes to flash once per HISTORY_PERSIST_S, at most one flash operation per pass
+  uint32_t now = epoch_ms() / 1000;
+  if (history.PersistDue(now) && !history.Persist(now))
+    Log.Error("Could not write the height history" CR);
+#endif
+}
+
+/**
+ * @brief Restores the state saved before the last reset or power cycle,
+ *        so the table doesn't need to move to learn its height
+ * 
+ * @return true if a height was restored
+ */
+bool restore_state() {
+  DeskState s;
+  DeskStateStore::Source source = deskState.Load(s);
+  if (source == DeskStateStore::NONE || !isValidHeight(s.height)) {
+    Log.Info("No saved state" CR);
+    return false;
+  }
+
+  currentHeight = targetHeight = s.height;
+  if (isValidHeight(s.high_target))
+    highTarget = s.high_target;
+  if (isValidHeight(s.low_target))
+    lowTarget = s.low_target;
+  Log.Info("Restored state from %s. Height: %d cm, targets: %d/%d cm" CR,
+           DeskStateStore::SourceName(source), currentHeight, lowTarget, highTarget);
+
+  // never resume a move that was cut short by the reset
+  if (s.direction)
+    Log.Error("Reset while moving %s, table stays stopped" CR, s.direction > 0 ? "up" : "down");
+  return true;
+}
+
+/**
+ * @brief Hands targets and limits to the flash store and applies the limits
+ * 
+ */
+void save_settings() {
+  uint8_t settings[4] = {highTarget, lowTarget, minHeight, maxHeight};
+  store.Put(KEY_SETTINGS, settings, sizeof(settings));
+  supervisor.min_height = minHeight;
+  supervisor.max_height = maxHeight;
+  save_state();
+}
+
+/**
+ * @brief Loads targets and limits changed at runtime from the flash store
+ * 
+ */
+void load_settings() {
+  uint8_t settings[4];
+  if (!store.Get(KEY_SETTINGS, settings, sizeof(settings)) || settings[2] >= settings[3])
+    return;
+
+  highTarget = settings[0];
+  lowTarget = settings[1];
+  minHeight = settings[2];
+  maxHeight = settings[3];
+  Log.Info("Settings from flash. Targets: %d/%d cm, limits: %d-%d cm" CR, lowTarget, highTarget, minHeight, maxHeight);
+}
+
+/**
+ * @brief Loads the measured motion of the desk from the flash store
+ * 
+ */
+void load_motion() {
+  MotionCalibration cal;
+  if (store.Get(KEY_MOTION, &cal, sizeof(cal)) && motion.Load(cal))
+    Log.Info("Motion from flash. Up: %d mm/s, down: %d mm/s, start: %d ms" CR, cal.up_mmps, cal.down_mmps, cal.start_ms);
+}
+
+#pragma endregion
+
+#pragma region Presets
+
+/**
+ * @brief Saves the current height as the high or the low target, whichever
+ *        is closer, so a double press returns here. Like
+ *        https://github.com/talsalmona/RoboDesk/blob/master/RoboDesk.ino
+ * 
+ */
+void save_position() {
+  if (!isValidHeight(currentHeight)) {
+    Log.Error("Not saving invalid height: %d cm" CR, currentHeight);
+    return;
+  }
+
+  bool high = abs(currentHeight - highTarget) < abs(currentHeight - lowTarget);
+  if (high)
+    highTarget = currentHeight;
+  else
+    lowTarget = currentHeight;
+  save_settings();
+
+  Log.Info("Saved %s target: %d cm" CR, high ? "high" : "low", currentHeight);
+  mqtt_publish(TOPIC("preset"), (String(high ? "high " : "low ") + String(currentHeight)).c_str());
+}
+
+/**
+ * @brief Saves the current height in one of the presets kept in flash
+ * 
+ * @param slot preset 1-4
+ */
+void save_preset(uint8_t slot) {
+  if (slot < 1 || slot > PRESET_COUNT || !isValidHeight(currentHeight)) {
+    Log.Error("Cannot save preset %d at height %d cm" CR, slot, currentHeight);
+    return;
+  }
+
+  store.Put(KEY_PRESET1 + slot - 1, &currentHeight, sizeof(currentHeight));
+  Log.Info("Saved preset %d: %d cm" CR, slot, currentHeight);
+  mqtt_publish(TOPIC("preset"), (String(slot) + " " + String(currentHeight)).c_str());
+}
+
+/**
+ * @brief Moves the table to one of the presets kept in flash
+ * 
+ * @param slot preset 1-4
+ */
+void recall_preset(uint8_t slot) {
+  uint8_t height;
+  if (slot < 1 || slot > PRESET_COUNT || !store.Get(KEY_PRESET1 + slot - 1, &height, sizeof(height))) {
+    Log.Error("Preset %d is not set" CR, slot);
+    return;
+  }
+  if (!isValidHeight(height)) {
+    Log.Error("Preset %d: %d cm is outside the limits" CR, slot, height);
+    return;
+  }
+
+  commands.Supersede();
+  set_target(height);
+  Log.Info("Start setting height. Preset %d: %d cm. Current height: %d cm." CR, slot, targetHeight, currentHeight);
+}
+
+/**
+ * @brief Changes a target or limit from an MQTT command like "high 120"
+ * 
+ * @return true if the value was accepted
+ */
+bool set_setting(const String & name, int value) {
+  if (name == "high" && isValidHeight(value)) {
+    highTarget = value;
+  } else if (name == "low" && isValidHeight(value)) {
+    lowTarget = value;
+  } else if (name == "min" && value >= tableMin && value < maxHeight) {
+    minHeight = value;
+  } else if (name == "max" && value <= tableMax && value > minHeight) {
+    maxHeight = value;
+  } else {
+    Log.Error("Invalid %s: %d cm [min: %d cm, max: %d cm]" CR, name.c_str(), value, minHeight, maxHeight);
+    return false;
+  }
+
+  save_settings();
+  Log.Info("Set %s to %d cm" CR, name.c_str(), value);
+  return true;
+}
+
 #pragma endregion
 
 #pragma region Logicdata related
@@ -96,7 +475,13 @@ bool isValidHeight(int checkHeight, Directions direction = STOPPED) {
  * 
  */
 void IRAM_ATTR logicDataPin_ISR() {
-  logicData.PinChange(HIGH == digitalRead(LOGICDATA_RX));
+  bool level = logicDataPin::Read();
+  wakeup = true;
+  last_wakeup = millis();
+#if ENABLE_SESSION_RECORD
+  session.Edge(level);
+#endif
+  logicData.PinChange(level);
 }
 
 /**
@@ -106,7 +491,13 @@ void IRAM_ATTR logicDataPin_ISR() {
  */
 void check_display() {
   static uint32_t prev = 0;
+#ifdef ISR_TARGET_STOP
+  uint32_t msg;
+  if (!decoded.pop(&msg))
+    msg = 0;
+#else
   uint32_t msg = logicData.ReadTrace();
+#endif
   char buf[80];
   if (msg) {
     uint32_t now = millis();
@@ -114,6 +505,12 @@ void check_display() {
     Log.Debug("%s" CR, buf);
     log(msg);
     prev=now;
+
+#if ENABLE_TELEMETRY
+    // only catalogue what we don't understand yet
+    if (learner.enabled && logicData.IsValid(msg) && !logicData.IsKnown(msg))
+      learner.Record(msg, now);
+#endif
   }
 
   // Reset idle-activity timer if display number changes or if any other display activity occurs (i.e. display-ON)
@@ -123,6 +520,9 @@ void check_display() {
       return;
     }
     currentHeight = new_height;
+    supervisor.Height(currentHeight, millis());
+    motion.Height(currentHeight, millis());
+    save_state();
   }
   if (msg)
     last_signal = millis();
@@ -132,41 +532,137 @@ void check_display() {
 
 #pragma region Table Movement
 
+/**
+ * @brief Hardware timer callback: drops the motor pins as soon as the
+ *        supervisor sees a stall, a passed limit or a hung loop.
+ *        With ISR_TARGET_STOP it also decodes LogicData words and stops
+ *        the motor right when the target height is reached.
+ * 
+ */
+void IRAM_ATTR supervisor_ISR() {
+  bool stop = supervisor.Check(millis());
+  // ends LogicData frames once the line is idle, so the last word of a report
+  // is decoded right away instead of with the next one
+  logicData.Service();
+
+#ifdef ISR_TARGET_STOP
+  uint32_t msg;
+  while ((msg = logicData.ReadTrace())) {
+    decoded.push(msg);
+    if (logicData.IsNumber(msg) && supervisor.Reached(logicData.GetNumber(msg), millis()))
+      stop = true;
+  }
+#endif
+
+  if (stop) {
+    assertUpPin::Write(LOW);
+    assertDownPin::Write(LOW);
+    // a desk driven over LOGICDATA_TX only stops when it is told to
+    logicData.SendCommand(LogicData::CMD_STOP);
+  }
+}
+
+/**
+ * @brief Drives the motor in the given direction, either by sending the native
+ *        handset command over LOGICDATA_TX or by asserting the relay pins
+ * 
+ * @param tmpDirection UP/DOWN or STOPPED to release the motor
+ */
+void drive_motor(Directions tmpDirection) {
+  // arm before driving so the supervisor never misses a moving motor;
+  // don't drive at all while a stop from the interrupt is pending
+  if (tmpDirection != STOPPED && !supervisor.Arm(tmpDirection == UP ? 1 : -1, millis()))
+    return;
+
+  LogicData::Command cmd = tmpDirection == UP ? LogicData::CMD_UP :
+                           tmpDirection == DOWN ? LogicData::CMD_DOWN : LogicData::CMD_STOP;
+  if (logicData.CanSend() && LogicData::HasCommand(cmd)) {
+    // the word goes out from the timer; repeat it like a held handset button
+    if (tmpDirection != direction || millis() - last_command > command_repeat_time) {
+      logicData.SendCommand(cmd);
+      last_command = millis();
+    }
+  } else {
+    assertUpPin::Write(tmpDirection == UP);
+    assertDownPin::Write(tmpDirection == DOWN);
+  }
+
+  if (tmpDirection == STOPPED)
+    supervisor.Disarm();
+}
+
 /**
  * @brief Stops the table and resets variables
  * 
  */
 void stop_table() {
-    digitalWrite(ASSERT_UP, LOW);
-    digitalWrite(ASSERT_DOWN, LOW);
+    drive_motor(STOPPED);
+    supervisor.ClearTarget();
     targetHeight = currentHeight;
     setHeight = false;
 
     if (direction != STOPPED) {
-      mqttClient.publish((MQTT_TOPIC + "state").c_str(), "stopped");
+      mqtt_publish(TOPIC("state"), "stopped");
       direction = STOPPED;
+      save_state();
+      if (motion.Stop()) {
+        // written with the desk state once the table is at rest
+        store.Put(KEY_MOTION, &motion.cal, sizeof(motion.cal));
+        Log.Debug("Motion: up %d mm/s, down %d mm/s, start %d ms" CR, motion.cal.up_mmps, motion.cal.down_mmps, motion.cal.start_ms);
+      }
     }
 }
 
+/**
+ * @brief Runs from loop(): checks in with the supervisor and brings the
+ *        firmware into a stopped state after it tripped
+ * 
+ */
+void check_safety() {
+  supervisor.Heartbeat(millis());
+
+  MotionSupervisor::Fault fault = supervisor.TakeFault();
+  if (fault == MotionSupervisor::NONE)
+    return;
+
+  if (fault == MotionSupervisor::TARGET) {
+    // the interrupt already stopped the motor, this is just bookkeeping
+    Log.Info("Hit target height: %d cm" CR, targetHeight);
+    stop_table();
+    return;
+  }
+
+  Log.Error("Safety stop (%s). Current height: %d cm" CR, MotionSupervisor::FaultName(fault), currentHeight);
+  safety_latched = true;
+  commands.Fail(MotionSupervisor::FaultName(fault));
+  stop_table();
+  mqtt_publish(TOPIC("fault"), MotionSupervisor::FaultName(fault));
+}
+
 /**
  * @brief Moves the table up or down
  * 
  * @param tmpDirection The direction the table moves to (up/down)
  */
 void move_table(Directions tmpDirection) {
+  if (safety_latched)
+    return;
+
   // currentHeight is initially 0 before the first move
   if (currentHeight == 0 || isValidHeight(currentHeight, tmpDirection)) {
-    // move the table up or down setting the pins to high/low
-    digitalWrite(ASSERT_UP, (tmpDirection == UP ? HIGH : LOW));
-    digitalWrite(ASSERT_DOWN, (tmpDirection == DOWN ? HIGH : LOW));
+    // move the table up or down setting the pins to high/low (or sending the command)
+    drive_motor(tmpDirection);
 
     //make sure to only log if there was a change
     if (direction != tmpDirection) {
-      mqttClient.publish((MQTT_TOPIC + "state").c_str(), (tmpDirection == UP ? "up" : "down"));
+      mqtt_publish(TOPIC("state"), (tmpDirection == UP ? "up" : "down"));
+      motion.Start(tmpDirection == UP ? 1 : -1, currentHeight, millis());
       direction = tmpDirection;
+      save_state();
     }
   } else if (!isValidHeight(currentHeight, tmpDirection)) {
     Log.Error("Non valid height [%d] received. Stopping table." CR, currentHeight);
+    commands.Fail("invalid height");
     stop_table();
   }
 }
@@ -177,12 +673,8 @@ void move_table(Directions tmpDirection) {
  * @param highLowTarget Used to leverage UP/DOWN as high/low height targets
  */
 void move_table_to_fixed(Directions highLowTarget) {
-    setHeight = true;
-
-    if (highLowTarget == UP)
-      targetHeight = highTarget;
-    else if (highLowTarget == DOWN)
-      targetHeight = lowTarget;
+    commands.Supersede();
+    set_target(highLowTarget == UP ? highTarget : lowTarget);
 
     Log.Info("Start setting height. %s target: %d cm. Current height: %d cm." CR,
               highLowTarget == UP ? "High" : "Low",
@@ -198,18 +690,33 @@ void move_table_to_fixed(Directions highLowTarget) {
 void move() {
   //btn_last_state has the current buttons pressed
   if(btn_last_state[0] && btn_last_state[1]) {
-    //both buttons pressed, do nothing
-    //TODO: Save position to EEPROM like https://github.com/talsalmona/RoboDesk/blob/master/RoboDesk.ino
-    Log.Debug("Both buttons pressed" CR);
-  } else if(btn_last_state[0]) {
+    //both buttons pressed: stop and save the position once per press
+    commands.Supersede();
+    if (direction != STOPPED)
+      stop_table();
+    if (!both_pressed) {
+      both_pressed = true;
+      save_position();
+    }
+    return;
+  }
+  both_pressed = false;
+
+  if(btn_last_state[0]) {
     //left button pressed
+    commands.Supersede();
+    supervisor.ClearTarget();
     move_table(UP);
     return;
   } else if(btn_last_state[1]) {
     //right button pressed
+    commands.Supersede();
+    supervisor.ClearTarget();
     move_table(DOWN);
     return;
   } else if (!setHeight) {
+    // buttons released: a new press may move the table again
+    safety_latched = false;
     if( direction != STOPPED) {
       Log.Info("button [%s] press stopped. Current height: %d cm" CR, direction == UP ? "up" : "down", currentHeight);
       stop_table();
@@ -217,15 +724,18 @@ void move() {
     return;
   }
 
-  if((millis() - last_signal > signal_giveup_time) && !setHeight) {
+  if(setHeight && millis() - last_signal > signal_giveup_time) {
     Log.Error("Haven't seen input in a while, turning everything off for safety" CR);
+    commands.Fail("no signal");
     stop_table();
-    while(true) ;
+    return;
   }
 
   // move the table if in setHeight-mode
   if(currentHeight != targetHeight) {
     if (setHeight) {
+      // publish the target so the interrupt can stop exactly on it
+      supervisor.SetTarget(targetHeight, currentHeight > targetHeight ? -1 : 1);
       if (currentHeight > targetHeight)
         move_table(DOWN);
       else
@@ -239,7 +749,242 @@ void move() {
   }
 }
 
+/**
+ * @brief Recalls one of the memory positions stored in the controller.
+ *        The controller positions itself, we only follow the reported height.
+ * 
+ * @param slot memory position 1-4
+ * @return true if the command was sent
+ */
+bool recall_memory(uint8_t slot) {
+  if (slot < 1 || slot > 4)
+    return false;
+
+  LogicData::Command cmd = (LogicData::Command)(LogicData::CMD_MEM1 + slot - 1);
+  if (!logicData.CanSend() || !LogicData::HasCommand(cmd)) {
+    Log.Error("Memory position %d not supported by this controller" CR, slot);
+    return false;
+  }
+
+  commands.Supersede();
+  setHeight = false;
+  logicData.SendCommand(cmd);
+  last_signal = millis();
+  Log.Info("Recalling memory position %d. Current height: %d cm" CR, slot, currentHeight);
+  return true;
+}
+
+/**
+ * @brief Runs the steps of queued commands one after the other
+ * 
+ */
+void queue_service() {
+  const QueueStep * step = commands.Current();
+  if (!step)
+    return;
+
+  uint32_t now = millis();
+  char height[4];
+  sprintf(height, "%u", currentHeight);
+
+  if (!commands.started) {
+    commands.started = true;
+    commands.started_ms = now;
+
+    if (step->kind == STEP_STOP) {
+      stop_table();
+      commands.StepDone(height);
+    } else if (step->kind != STEP_WAIT && step->kind != STEP_WAIT_MS) {
+      uint8_t target = step->kind == STEP_HIGH ? highTarget :
+                       step->kind == STEP_LOW ? lowTarget : step->value;
+      if (!isValidHeight(target)) {
+        Log.Error("Queue: invalid height: %d cm" CR, target);
+        commands.Fail("invalid height");
+        return;
+      }
+      set_target(target);
+      Log.Info("Queue: setting height. Target: %d cm. Current height: %d cm" CR, targetHeight, currentHeight);
+    }
+    return;
+  }
+
+  // failures and interruptions are reported where they happen
+  if (step->kind == STEP_WAIT ? now - commands.started_ms >= step->value * 1000UL :
+      step->kind == STEP_WAIT_MS ? now - commands.started_ms >= step->value : !setHeight)
+    commands.StepDone(height);
+}
+
+/**
+ * @brief Publishes events of commands with an id to <MQTT_TOPIC>event
+ *        as "<id> <event>[ <detail>]"
+ * 
+ */
+void queue_event(const char * id, const char * event, const char * detail) {
+  String payload = String(id) + " " + event;
+  if (detail[0])
+    payload += String(" ") + detail;
+  Log.Info("Command %s" CR, payload.c_str());
+  mqtt_publish(TOPIC("event"), payload.c_str());
+#if ENABLE_LOCAL_ENDPOINT
+  local.Send(LOCAL_EVENT, (const uint8_t *)payload.c_str(), payload.length() < LOCAL_MAX_PAYLOAD ? payload.length() : LOCAL_MAX_PAYLOAD);
+#endif
+}
+
+#pragma endregion
+
+#if ENABLE_TELEMETRY
+#pragma region Protocol learning
+
+/**
+ * @brief Dumps the learned words to Serial and, if connected, to <MQTT_TOPIC>learn
+ *        one word per line/message: "<word> <count> <first seen ms> <last seen ms>"
+ * 
+ */
+void learn_dump() {
+  char buf[48];
+  LearnedWord e;
+  uint16_t i = 0;
+
+  Log.Info("Learned %d words, %d dropped" CR, learner.Used(), learner.Dropped());
+  while (learner.Get(i, e)) {
+    sprintf(buf, "%08x %u %u %u", (unsigned)e.word, (unsigned)e.count,
+            (unsigned)e.first_seen, (unsigned)e.last_seen);
+    Log.Info("%s %s" CR, buf, logicData.Decode(e.word));
+    if (mqtt_connected())
+      mqtt_publish(TOPIC("learn"), buf);
+  }
+}
+
+#pragma endregion
+#endif
+
+#if ENABLE_CAPTURE
+#pragma region Edge capture
+
+void IRAM_ATTR capture_edge(micros_t delta, bool level) {
+  capture.Push(delta, level);
+}
+
+/**
+ * @brief Streams captured edges in frames to <MQTT_TOPIC>capture,
+ *        or as hex lines on Serial if MQTT is not connected.
+ *        At most one frame per loop pass so motion control keeps running.
+ * 
+ */
+void capture_service() {
+  // wait for a full frame unless the capture was stopped and needs flushing
+  if (capture.Available() < (capture.active ? CAPTURE_CHUNK_SIZE : 1))
+    return;
+
+  uint8_t frame[CAPTURE_FRAME_HEADER + CAPTURE_CHUNK_SIZE];
+  size_t len = capture.ReadFrame(frame);
+
+  if (mqtt_connected()) {
+    mqtt_publish(TOPIC("capture"), frame, len, false);
+  } else {
+    char hex[2 * sizeof(frame) + 1];
+    for (size_t i = 0; i < len; i++)
+      sprintf(hex + 2 * i, "%02x", frame[i]);
+    Log.Info("CAP %s" CR, hex);
+  }
+}
+
 #pragma endregion
+#endif
+
+#if ENABLE_SESSION_RECORD
+#pragma region Session recording
+
+/**
+ * @brief Streams the recorded session in frames to <MQTT_TOPIC>session.
+ *        Replay it on the host with tools/session_replay.
+ * 
+ */
+void session_service() {
+  if (session.Available() < (session.active ? SESSION_CHUNK_SIZE : 1) || !mqtt_connected())
+    return;
+
+  uint8_t frame[SESSION_FRAME_HEADER + SESSION_CHUNK_SIZE];
+  size_t len = session.ReadFrame(frame);
+  mqtt_publish(TOPIC("session"), frame, len, false);
+}
+
+#pragma endregion
+#endif
+
+#if ENABLE_TELEMETRY
+#pragma region Height history
+
+/**
+ * @brief Feeds the height history once the clock is set. Heights at or above
+ *        the middle between the low and high target count as standing.
+ * 
+ */
+void history_service() {
+  history.stand_height = (lowTarget + highTarget) / 2;
+  history.Tick(epoch_ms() / 1000, currentHeight, direction != STOPPED || setHeight);
+}
+
+void history_publish(const char * line) {
+  Log.Info("History: %s" CR, line);
+  if (mqtt_connected())
+    mqtt_publish(TOPIC("history"), line);
+}
+
+/**
+ * @brief Answers a history query to <MQTT_TOPIC>history, one line per message:
+ *        ""                          "today <stand> <sit> week <stand> <sit>" in minutes
+ *        "days|hours|minutes [<n>]"  "<start> <stand> <sit> <mean> <low> <high>" per period,
+ *                                    oldest first, seconds (minutes for days) and cm
+ *        "events [<from> [<to>]]"    "<time> <height>" per height the table settled at
+ *        Times are Unix seconds.
+ * 
+ * @param args what followed "history"
+ */
+void history_query(String args) {
+  char buf[48];
+  args.trim();
+
+  if (args.length() == 0) {
+    uint32_t today_stand, today_sit, week_stand, week_sit;
+    history.Totals(1, today_stand, today_sit);
+    history.Totals(7, week_stand, week_sit);
+    sprintf(buf, "today %u %u week %u %u", (unsigned)today_stand, (unsigned)today_sit,
+            (unsigned)week_stand, (unsigned)week_sit);
+    history_publish(buf);
+  } else if (args.startsWith("days") || args.startsWith("hours") || args.startsWith("minutes")) {
+    HistoryLevel level = args[0] == 'd' ? HISTORY_DAY : args[0] == 'h' ? HISTORY_HOUR : HISTORY_MINUTE;
+    int space = args.indexOf(' ');
+    int count = space > 0 ? args.substring(space + 1).toInt() : level == HISTORY_DAY ? 7 : level == HISTORY_HOUR ? 24 : 60;
+    uint32_t start;
+    HistoryBucket b;
+    for (int age = constrain(count, 1, 255) - 1; age >= 0; age--) {
+      if (!history.Get(level, age, start, b) || !b.mean)
+        continue;
+      sprintf(buf, "%u %u %u %u %u %u", (unsigned)start, b.stand, b.sit, b.mean, b.low, b.high);
+      history_publish(buf);
+    }
+  } else if (args.startsWith("events")) {
+    uint32_t from = 0, to = UINT32_MAX;
+    int space = args.indexOf(' ');
+    if (space > 0) {
+      from = strtoul(args.c_str() + space + 1, nullptr, 10);
+      int second = args.indexOf(' ', space + 1);
+      if (second > 0)
+        to = strtoul(args.c_str() + second + 1, nullptr, 10);
+    }
+    HistoryCursor c;
+    for (bool more = history.First(c); more; more = history.Next(c)) {
+      if (c.event.time < from || c.event.time > to)
+        continue;
+      sprintf(buf, "%u %u", (unsigned)c.event.time, c.event.height);
+      history_publish(buf);
+    }
+  }
+}
+
+#pragma endregion
+#endif
 
 #pragma region MQTT functions
 
@@ -249,6 +994,14 @@ void move() {
  * @param message is checked to correspond to prexisting commands
  */
 void mqtt_callCmd(String message) {
+    char id[QUEUE_ID_LEN + 1];
+    CommandQueue::SplitId(message.c_str(), id);
+    if (id[0]) {
+      // commands with an id replace whatever runs and are tracked by the queue
+      commands.Replace(message.c_str());
+      return;
+    }
+
     if (message == "debug") {
       if (mqttLog == false)
         mqttLog = true;
@@ -262,32 +1015,170 @@ void mqtt_callCmd(String message) {
         move_table_to_fixed(DOWN);
     } else if (message == "stop") {
         Log.Info("MQTT: Received stop. Current height: %d cm" CR, currentHeight);
+        commands.Supersede();
         stop_table();
     } else if (message == "ping") {
         // we do want some kind of test message to see if things work
         Log.Debug("MQTT: pong. Current height: %d cm" CR, currentHeight);
-        mqttClient.publish((MQTT_TOPIC + "cmd").c_str(), "pong");
+        mqtt_publish(TOPIC("cmd"), "pong");
+#if ENABLE_TELEMETRY
+    } else if (message == "stats") {
+        char buf[144];
+#if ENABLE_MQTT
+        uint32_t connects = mqttBackoff.attempts - mqttBackoff.failures, failed = mqttBackoff.failures;
+#else
+        uint32_t connects = 0, failed = 0;
+#endif
+        sprintf(buf, "glitches %u races %u bit %uus set %u dropped %u reversals %u connects %u failed %u busy %u%%",
+                (unsigned)logicData.Glitches(), (unsigned)logicData.Races(), (unsigned)logicData.BitTime(),
+                (unsigned)setCommands.received, (unsigned)setCommands.dropped, (unsigned)setCommands.reversals,
+                (unsigned)connects, (unsigned)failed, (unsigned)duty.Busy());
+        Log.Info("LogicData: %s" CR, buf);
+        mqtt_publish(TOPIC("cmd"), buf);
+    } else if (message == "history" || message.startsWith("history ")) {
+        history_query(message.substring(7));
+    } else if (message == "learn") {
+        learner.enabled = !learner.enabled;
+        Log.Info("%s protocol learning" CR, learner.enabled ? "Activated" : "Deactivated");
+    } else if (message == "learn dump") {
+        learn_dump();
+    } else if (message == "learn clear") {
+        learner.Clear();
+#endif
+#if ENABLE_CAPTURE
+    } else if (message == "capture start") {
+        capture.Start();
+        Log.Info("Edge capture started" CR);
+    } else if (message == "capture stop") {
+        capture.Stop();
+        Log.Info("Edge capture stopped. %l edges, %l overruns" CR, capture.edges, capture.overruns);
+#endif
+#if ENABLE_SESSION_RECORD
+    } else if (message == "record start") {
+        session.Start();
+        Log.Info("Session recording started" CR);
+    } else if (message == "record stop") {
+        session.Stop();
+        Log.Info("Session recording stopped. %l events, %l overruns" CR, session.events, session.overruns);
+#endif
+    } else if (message.startsWith("mem") && message.length() == 4) {
+        recall_memory(message[3] - '0');
+    } else if (message == "save high" || message == "save low") {
+        if (set_setting(message.substring(5), currentHeight))
+          mqtt_publish(TOPIC("preset"), (message.substring(5) + " " + String(currentHeight)).c_str());
+    } else if (message.startsWith("save") && message.length() == 5) {
+        save_preset(message[4] - '0');
+    } else if (message.startsWith("preset") && message.length() == 7) {
+        recall_preset(message[6] - '0');
+    } else if (message.startsWith("high ") || message.startsWith("low ") ||
+               message.startsWith("min ") || message.startsWith("max ")) {
+        int space = message.indexOf(' ');
+        set_setting(message.substring(0, space), message.substring(space + 1).toInt());
     }
 }
 
 /**
- * @brief Callback function on receiving a height
+ * @brief Callback function on receiving a height. The target is only queued,
+ *        set_service() applies the latest one per coalescing window.
  * 
  * @param message must be an int, needs to be within height range
  * @param length message length
  */
 void mqtt_callSet(byte* message, int length) {
+    message[length] = '\0';
+    char id[QUEUE_ID_LEN + 1];
+    CommandQueue::SplitId((char *)message, id);
+    if (id[0]) {
+      // a target with an id skips coalescing and is tracked by the queue
+      commands.Replace((char *)message);
+      return;
+    }
+
     int height_in = convertCharToInt((char* )message, length);
     if (isValidHeight(height_in)) {
-      targetHeight = height_in;
-      setHeight = true;
+      setCommands.Offer(height_in);
+      Log.Debug("MQTT: Queued target: %d cm" CR, height_in);
     } else {
       Log.Error("Invalid height: %d! [min: %d cm, max: %d cm]" CR, height_in, minHeight, maxHeight);
     }
-    
-    Log.Info("Setting height. Target: %d cm. Current height: %d cm" CR, targetHeight, currentHeight);
 }
 
+#if ENABLE_MQTT
+/**
+ * @brief Callback function for group moves on MQTT_GROUP_TOPIC:
+ *        "[<id>:]<cm> <start>[ <span>]". start is the Unix time in ms the move
+ *        begins at (SNTP), or "+<ms>" after receipt. With a span in ms every desk
+ *        holds back its own start by what its measured motion needs, so the
+ *        group arrives together at start + span; without one they start together.
+ *        The move runs through the queue, so a direct command or a button stops it.
+ * 
+ * @param message the group command
+ */
+void mqtt_callGroup(const String & message) {
+  QueuedCommand c;
+  char * p = (char *)CommandQueue::SplitId(message.c_str(), c.id);
+  long target = strtol(p, &p, 10);
+  while (*p == ' ') p++;
+
+  int64_t start_in; // ms from now
+  const char * error = nullptr;
+  if (*p == '+') {
+    start_in = strtol(p + 1, &p, 10);
+  } else {
+    uint64_t start = strtoull(p, &p, 10);
+    uint64_t now = epoch_ms();
+    start_in = now ? int64_t(start - now) : 0;
+    if (!now)
+      Log.Error("Group: clock not set, starting right away" CR);
+  }
+  uint32_t span = strtoul(p, &p, 10);
+
+  int64_t delay = start_in;
+  if (span)
+    delay += int64_t(span) - motion.TravelMs(currentHeight, target);
+  if (!isValidHeight(target))
+    error = "invalid height";
+  else if (delay > group_max_lead)
+    error = "too far ahead";
+  if (error) {
+    Log.Error("Group: %s" CR, error);
+    if (c.id[0])
+      queue_event(c.id, "failed", error);
+    return;
+  }
+  if (delay < 0) {
+    Log.Error("Group: late by %d ms" CR, (int)-delay);
+    delay = 0;
+  }
+
+  c.count = 0;
+  if (delay)
+    c.steps[c.count++] = {STEP_WAIT_MS, (uint16_t)delay};
+  c.steps[c.count++] = {STEP_MOVE, (uint16_t)target};
+  Log.Info("Group: moving to %d cm in %d ms" CR, (int)target, (int)delay);
+  commands.Supersede();
+  commands.Push(c);
+}
+#endif
+
+/**
+ * @brief Applies the latest target from MQTT set messages, at most one per
+ *        coalescing window
+ * 
+ */
+void set_service() {
+  uint8_t target = setCommands.Take(millis(), currentHeight,
+                                    direction_sign(),
+                                    setHeight ? targetHeight : 0);
+  if (!target)
+    return;
+
+  commands.Supersede();
+  set_target(target);
+  Log.Info("Setting height. Target: %d cm. Current height: %d cm" CR, targetHeight, currentHeight);
+}
+
+#if ENABLE_MQTT
 /**
  * @brief Default MQTT callback function returning everything that is sent to subscribed topics
  *        also takes care of sending messages to dedicated callback functions if necessary
@@ -297,6 +1188,9 @@ void mqtt_callSet(byte* message, int length) {
  * @param length message length
  */
 void mqtt_callback(char* topic, byte* message, unsigned int length) {
+#if ENABLE_SESSION_RECORD
+  session.Message(topic, message, length);
+#endif
   Log.Debug("MQTT: Topic: %s. Message [%d]: ", topic, length);
   String messageTemp;
   
@@ -306,50 +1200,223 @@ void mqtt_callback(char* topic, byte* message, unsigned int length) {
   }
   Log.Debug(CR);
 
-  if ((String) topic == MQTT_TOPIC + "set") {
+  if (!strcmp(topic, TOPIC("set"))) {
     mqtt_callSet(message, length);
   }
 
-  if ((String) topic == MQTT_TOPIC + "cmd") {
+  if (!strcmp(topic, TOPIC("cmd"))) {
     mqtt_callCmd(messageTemp);
   }
+
+  if (!strcmp(topic, TOPIC("queue"))) {
+    commands.Push(messageTemp.c_str());
+  }
+
+  if (!strcmp(topic, MQTT_GROUP_TOPIC)) {
+    mqtt_callGroup(messageTemp);
+  }
 }
 
 /**
- * @brief Takes care of publishingt the current height if it hasn't been published in a
- *        certain amount of time
+ * @brief Publishes the current height as PublishPolicy says: often while moving,
+ *        right away when the table stopped and as a heartbeat at rest
  * 
  */
 void mqtt_publishHeight() {
-    long now = millis();
-    if (publishedHeight != currentHeight && now - lastPublish > 2000)
-    {
-        lastPublish = now;
-        publishedHeight = currentHeight;
-        mqttClient.publish((MQTT_TOPIC + "height").c_str(), convertToChar(currentHeight));
-    }
+  bool moving = direction != STOPPED || setHeight;
+  if (!mqttClient.connected()) {
+    // keep following the motion so a stop while offline is published on reconnect
+    heightPolicy.Track(moving);
+    return;
+  }
+  if (!heightPolicy.Due(millis(), currentHeight, moving))
+    return;
+
+  char buf[4];
+  sprintf(buf, "%u", currentHeight);
+  mqtt_publish(TOPIC("height"), buf);
+}
+
+/**
+ * @brief Publishes the retained state snapshot when something in it changed,
+ *        so a client gets the whole state from one message on subscribe:
+ *        {"h":100,"t":110,"d":"up","min":78,"max":128,"lo":88,"hi":125,"fault":0,"gen":3,"up":1234,"v":"..."}
+ *        gen changes with the stats counters, up is uptime in seconds at publish time.
+ * 
+ */
+void snapshot_service() {
+  if (!mqtt_connected())
+    return;
+
+  uint32_t now = millis();
+  uint32_t sum = logicData.Glitches() + logicData.Races() + setCommands.received + setCommands.dropped + setCommands.reversals;
+  bool counters = sum != stats_sum;
+
+  Snapshot s;
+  memset(&s, 0, sizeof(s));
+  s.height = currentHeight;
+  s.target = setHeight ? targetHeight : 0;
+  s.direction = direction_sign();
+  s.min = minHeight;
+  s.max = maxHeight;
+  s.low = lowTarget;
+  s.high = highTarget;
+  s.fault = safety_latched;
+  s.stats_gen = stats_gen + (counters ? 1 : 0);
+
+  if (snapshot_valid) {
+    bool state = memcmp(&s, &published_snapshot, offsetof(Snapshot, stats_gen)) != 0;
+    if (now - snapshot_time < (state ? snapshot_min_time : counters ? snapshot_stats_time : UINT32_MAX))
+      return;
+  }
+
+  char buf[160];
+  snprintf(buf, sizeof(buf),
+           "{\"h\":%u,\"t\":%u,\"d\":\"%s\",\"min\":%u,\"max\":%u,\"lo\":%u,\"hi\":%u,\"fault\":%u,\"gen\":%u,\"up\":%u,\"v\":\"%s\"}",
+           s.height, s.target, s.direction > 0 ? "up" : s.direction < 0 ? "down" : "stopped",
+           s.min, s.max, s.low, s.high, s.fault ? 1 : 0, (unsigned)s.stats_gen, (unsigned)(now / 1000), ROBODESK_VERSION);
+  if (!mqtt_publish(TOPIC("snapshot"), buf, true))
+    return;
+
+  published_snapshot = s;
+  snapshot_valid = true;
+  snapshot_time = now;
+  stats_gen = s.stats_gen;
+  stats_sum = sum;
+}
+#endif
+
+#pragma endregion
+
+#if ENABLE_LOCAL_ENDPOINT
+#pragma region Local endpoint
+
+/**
+ * @brief Handles a frame from a local client like the matching MQTT message
+ * 
+ */
+void local_frame(uint8_t type, uint8_t * payload, uint8_t len) {
+  switch (type) {
+    case LOCAL_CMD:
+      mqtt_callCmd(String((char *)payload));
+      break;
+    case LOCAL_SET:
+      mqtt_callSet(payload, len);
+      break;
+    case LOCAL_QUEUE:
+      commands.Push((char *)payload);
+      break;
+  }
+}
+
+/**
+ * @brief Serves local clients and streams height and direction changes to them
+ * 
+ */
+void local_service() {
+  static uint8_t sent_height = 0;
+  static int8_t sent_direction = 0;
+
+  local.Service();
+  local.Greet(currentHeight, direction_sign());
+  if (currentHeight != sent_height || direction_sign() != sent_direction) {
+    sent_height = currentHeight;
+    sent_direction = direction_sign();
+    uint8_t payload[2] = {sent_height, (uint8_t)sent_direction};
+    local.Send(LOCAL_HEIGHT, payload, sizeof(payload));
+  }
+}
+
+#pragma endregion
+#endif
+
+#pragma region Idle
+
+/**
+ * @brief Button interrupt: only ends a nap, the buttons are read from loop()
+ * 
+ */
+void IRAM_ATTR button_ISR() {
+  wakeup = true;
+  last_wakeup = millis();
+}
+
+/**
+ * @brief Whether the loop may nap: the table is at rest, nothing is queued,
+ *        no button is held and the line has been quiet for a moment
+ */
+bool may_nap() {
+  if (direction != STOPPED || setHeight || !commands.Empty() || setCommands.Pending())
+    return false;
+  if (millis() - last_wakeup < idle_holdoff)
+    return false;
+  for (uint8_t i = 0; i < BTN_COUNT; i++) {
+    if (btn_last_state[i] != 0)
+      return false;
+  }
+#ifdef ISR_TARGET_STOP
+  if (!decoded.empty())
+    return false;
+#endif
+#if ENABLE_CAPTURE
+  if (capture.active)
+    return false;
+#endif
+#if ENABLE_SESSION_RECORD
+  if (session.active)
+    return false;
+#endif
+  return true;
+}
+
+/**
+ * @brief Naps at the end of an idle loop pass, so the WiFi stack gets the CPU
+ *        and the radio can sleep between beacons. LogicData edges, buttons and
+ *        data from the broker or a local client end the nap early; everything
+ *        timed in the loop is coarse enough for IDLE_NAP_MS.
+ *        Also keeps the busy/idle accounting.
+ * 
+ */
+void idle_service() {
+  duty.Update(millis());
+  if (!may_nap())
+    return;
+
+  uint32_t start = micros();
+  esp_delay(IDLE_NAP_MS, []() {
+    return !wakeup
+#if ENABLE_MQTT
+           && !espClient.available()
+#endif
+#if ENABLE_LOCAL_ENDPOINT
+           && !local.Pending()
+#endif
+    ;
+  }, 1);
+  duty.Idle(micros() - start, wakeup);
 }
 
 #pragma endregion
 
 #pragma region Setup: Wifi, OTA, MQTT
 
+/**
+ * @brief Starts connecting to WiFi; check_wifi() follows the connection from loop()
+ *        so the buttons work while the network comes up
+ * 
+ */
 void setup_wifi() {
     WiFi.mode(WIFI_STA);
     WiFi.persistent(false);
-    #ifdef WIFICONFIG_H
-      WiFi.config(WIFI_IP, WIFI_DNS, WIFI_GATEWAY, WIFI_SUBNET);
-    #endif
+    if (Config::static_ip)
+      WiFi.config(IPAddress(Config::ip), IPAddress(Config::dns), IPAddress(Config::gateway), IPAddress(Config::subnet));
     WiFi.setAutoReconnect(true);
     WiFi.hostname("Robodesk");
-    WiFi.begin(WIFI_SSID, WIFI_PSK);
- 
-    while (WiFi.status() != WL_CONNECTED) {
-        delay(100);
-    }
-    Log.Info("WiFi: Connected! IP: %s" CR, (WiFi.localIP().toString().c_str()));
+    WiFi.setSleepMode(IDLE_SLEEP_MODE);
+    WiFi.begin(Config::wifi_ssid, Config::wifi_psk);
 }
 
+#if ENABLE_OTA
 void setup_OTA() {
   ArduinoOTA.onStart([]() {
     String type;
@@ -359,13 +1426,22 @@ void setup_OTA() {
       type = "filesystem";
 
     // NOTE: if updating SPIFFS this would be the place to unmount SPIFFS using SPIFFS.end()
-    Log.Info("Start updating %s" CR, type);
+    Log.Info("Start updating %s" CR, type.c_str());
+    ota_step = 0;
+    // the update blocks the loop until it is done, don't leave the table moving meanwhile
+    commands.Supersede();
+    stop_table();
   });
   ArduinoOTA.onEnd([]() {
     Log.Info(CR "End" CR);
   });
   ArduinoOTA.onProgress([](unsigned int progress, unsigned int total) {
-    Log.Info("Progress: %d%%\n", (progress / (total / 100)));
+    // called for every chunk of about 1kB; logging each slows the transfer down
+    uint8_t step = total ? (uint64_t)progress * OTA_PROGRESS_STEPS / total : 0;
+    if (step == ota_step)
+      return;
+    ota_step = step;
+    Log.Info("Progress: %d%%" CR, step * 100 / OTA_PROGRESS_STEPS);
   });
   ArduinoOTA.onError([](ota_error_t error) {
     Log.Error("Error[%d]: ", error);
@@ -382,29 +1458,83 @@ void setup_OTA() {
   });
   ArduinoOTA.begin();
 }
+#endif
+
+/**
+ * @brief Follows the WiFi connection without blocking.
+ *        OTA, SNTP and the local endpoint are started the first time the connection is up.
+ * 
+ * @return true while connected
+ */
+bool check_wifi() {
+  static bool connected = false;
+  static bool started = false;
 
+  bool up = WiFi.status() == WL_CONNECTED;
+  if (up != connected) {
+    connected = up;
+    if (up) {
+      Log.Info("WiFi: Connected! IP: %s" CR, (WiFi.localIP().toString().c_str()));
+      if (!started) {
+#if ENABLE_OTA
+        setup_OTA();
+#endif
+        configTime(0, 0, NTP_SERVER);
+#if ENABLE_LOCAL_ENDPOINT
+        local.Begin(local_frame);
+        Log.Info("Local endpoint on port %d" CR, LOCAL_PORT);
+#endif
+        started = true;
+      }
+    } else {
+      Log.Error("WiFi: Disconnected" CR);
+    }
+  }
+  return up;
+}
+
+#if ENABLE_MQTT
 void setup_mqtt() {
-  mqttClient.setServer(MQTT_BROKER, MQTT_PORT);
+  sprintf(mqttClientId, "Robodesk-%06x", (unsigned)(ESP.getChipId() & 0xffffff));
+  mqttClient.setServer(Config::mqtt_broker, Config::mqtt_port);
   mqttClient.setCallback(mqtt_callback);
 }
 
 void init_mqtt() {
-  if (!mqttClient.connected()) {
-      while (!mqttClient.connected()) {
-          if (mqttClient.connect("Robodesk",
-              MQTT_USER, MQTT_PASS,
-              (MQTT_TOPIC + "lastConnected").c_str(),
-              0,
-              true,
-              versionLine)) {
-            mqttClient.subscribe((MQTT_TOPIC + "set").c_str());
-            mqttClient.subscribe((MQTT_TOPIC + "cmd").c_str());
-          }
-          delay(100);
-      }
-  } else
+  if (mqtt_connected()) {
     mqttClient.loop();
+    return;
+  }
+  if (mqttConnected) {
+    mqttConnected = false;
+    mqttBackoff.Lost(millis());
+    Log.Error("MQTT: Connection lost, reconnecting in %d ms" CR, (int)mqttBackoff.Wait());
+  }
+  if (!mqttBackoff.Due(millis()))
+    return;
+
+  if (mqttClient.connect(mqttClientId,
+      Config::mqtt_user, Config::mqtt_pass,
+      TOPIC("lastConnected"),
+      0,
+      true,
+      versionLine)) {
+    mqttBackoff.Succeeded(millis());
+    mqttConnected = true;
+    Log.Info("MQTT: Connected as %s" CR, mqttClientId);
+    mqttClient.subscribe(TOPIC("set"));
+    mqttClient.subscribe(TOPIC("cmd"));
+    mqttClient.subscribe(TOPIC("queue"));
+    mqttClient.subscribe(MQTT_GROUP_TOPIC);
+    // the broker may have lost the retained snapshot, or hold one from before a reset
+    snapshot_valid = false;
+    heightPolicy.Invalidate();
+  } else {
+    mqttBackoff.Failed(millis());
+    Log.Error("MQTT: Connect failed (%d), retrying in %d ms" CR, mqttClient.state(), (int)mqttBackoff.Wait());
+  }
 }
+#endif
 
 #pragma endregion
 
@@ -423,31 +1553,81 @@ void setup() {
   Log.Info(CR "---------" CR);
   Log.Info("%s" CR, versionLine);
 
-  setup_wifi();
-  setup_OTA();
-  setup_mqtt();
+  if (!store.Begin())
+    Log.Error("No flash for the store, settings are kept until the next reset only" CR);
+  deskState.Begin(store, KEY_DESK_STATE);
+  commands.SetEventHook(queue_event);
+  load_settings();
+  load_motion();
+#if ENABLE_TELEMETRY
+  if (!history.Begin())
+    Log.Error("No flash for the height history, it is kept until the next reset only" CR);
+#endif
+  bool restored = restore_state();
+
+  // the supervisor runs from timer1, independent of anything blocking loop()
+  supervisor.min_height = minHeight;
+  supervisor.max_height = maxHeight;
+  if (restored)
+    supervisor.Height(currentHeight, millis());
+  timer1_attachInterrupt(supervisor_ISR);
+  timer1_enable(TIM_DIV16, TIM_EDGE, TIM_LOOP);
+  timer1_write(SUPERVISOR_PERIOD_US * 5); // 5 MHz after the divider
 
   logicDataPin_ISR();
   attachInterrupt(digitalPinToInterrupt(LOGICDATA_RX), logicDataPin_ISR, CHANGE);
+  attachInterrupt(digitalPinToInterrupt(BTN_UP), button_ISR, CHANGE);
+  attachInterrupt(digitalPinToInterrupt(BTN_DOWN), button_ISR, CHANGE);
 
   logicData.Begin();
+#if ENABLE_CAPTURE
+  logicData.SetEdgeHook(capture_edge);
+#endif
+
+  // local control is up, the network follows from loop()
+  setup_wifi();
+#if ENABLE_MQTT
+  setup_mqtt();
+#endif
 
   Log.Info("---------" CR);
 
-  // we use this just to get an initial height on startup (otherwise height is 0)
-  move_table(UP);
+  if (restored) {
+    // no phantom press of the up button on the first loop
+    btn_last_state[0] = 0;
+  } else {
+    // nothing saved yet: jog the table to get an initial height (otherwise height is 0)
+    move_table(UP);
+  }
 }
 
 void loop() {
+  // events from here on end the nap at the end of this pass right away
+  wakeup = false;
+
   // sets global currentHeight and last_signal from logicdata serial
   check_display();
+  check_safety();
+#if ENABLE_LOCAL_ENDPOINT
+  local_service();
+#endif
 
-  ArduinoOTA.handle();
-  init_mqtt();
+  // everything local above runs whether or not the network is there
+  if (check_wifi()) {
+#if ENABLE_OTA
+    ArduinoOTA.handle();
+#endif
+#if ENABLE_MQTT
+    init_mqtt();
+#endif
+  }
 
   // check the buttons
   for(uint8_t i=0; i < ARRAY_SIZE(btn_pins); ++i) {
     int btn_state = digitalRead(btn_pins[i]);
+#if ENABLE_SESSION_RECORD
+    session.Button(i, btn_state == HIGH);
+#endif
     if((btn_state == btn_pressed_state) != btn_last_state[i] && millis() - debounce[i] > debounce_time) {
       //change state
       btn_last_state[i] = (btn_state == btn_pressed_state);
@@ -458,13 +1638,13 @@ void loop() {
         if(millis() - btn_last_on[i] < double_time) {
           //double press
           Log.Info("button [%s] press (double)" CR, i == 0 ? "up" : "down");
-          mqttClient.publish((MQTT_TOPIC + "button").c_str(), i == 0 ? "double up" : "double down");
+          mqtt_publish(TOPIC("button"), i == 0 ? "double up" : "double down");
           move_table_to_fixed(i == 0 ? UP : DOWN);
         } else {
           btn_last_on[i] = debounce[i];
           //single press
           Log.Info("button [%s] press" CR, i == 0 ? "up" : "down");
-          mqttClient.publish((MQTT_TOPIC + "button").c_str(), i == 0 ? "single up" : "single down");
+          mqtt_publish(TOPIC("button"), i == 0 ? "single up" : "single down");
           if (setHeight) {
             Log.Info("Setting height end." CR);
             setHeight = false;
@@ -474,6 +1654,22 @@ void loop() {
     }
   }
 
+  set_service();
   move();
+  queue_service();
+#if ENABLE_TELEMETRY
+  history_service();
+#endif
+  persist_state();
+#if ENABLE_MQTT
   mqtt_publishHeight();
+  snapshot_service();
+#endif
+#if ENABLE_CAPTURE
+  capture_service();
+#endif
+#if ENABLE_SESSION_RECORD
+  session_service();
+#endif
+  idle_service();
 }
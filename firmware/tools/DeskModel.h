@@ -0,0 +1,171 @@
+// Simulated desk for host tools: the motor moves while the firmware asserts
+// ASSERT_UP/ASSERT_DOWN, and the controller reports the height on the
+// LogicData line while moving and for a while after, like the real one.
+//
+// The model is event driven: Update() integrates the motion up to now and
+// queues the edges of the next height word, Next() says when the next edge is
+// due and Fire() drives the edges that are due into the firmware through
+// host_pin_input().
+//
+// In transmit mode (LOGICDATA_TX) it also decodes the handset commands the
+// firmware sends, from the pin writes handed to PinOutput(): up and down move
+// the desk while they are repeated, stop stops it and mem1..mem4 drive it to
+// the positions in memory[].
+
+#ifndef DESK_MODEL_H
+#define DESK_MODEL_H
+
+#include <Arduino.h>
+#include <pins.h>      // before LogicData.h, it may hold the command words
+#include <LogicData.h>
+
+#include <deque>
+
+struct DeskModel {
+  double height = 100;            // cm
+  double speed = 3.8;             // cm/s
+  double min_height = 62;
+  double max_height = 128;
+  uint32_t word_period_us = 100000;
+  uint32_t display_us = 1000000;  // keeps reporting after the motor stopped
+
+  uint64_t last_us = 0;
+  uint64_t last_motion_us = 0;
+  uint64_t next_word_us = 0;
+  bool reporting = false;
+  bool level = HIGH;
+  std::deque<std::pair<uint64_t, bool>> edges;
+
+  // transmit mode
+  double memory[4] = {72, 90, 110, 120};
+  uint32_t hold_us = 500000;      // up/down keep the motor going this long
+  int8_t tx_drive = 0;
+  uint64_t tx_drive_us = 0;       // last up/down word
+  double tx_target = 0;           // memory position being driven to, 0 for none
+  uint32_t tx_words[LogicData::CMD_COUNT] = {};
+  uint32_t tx_errors = 0;         // bad parity or not a command word
+  bool tx_level = HIGH;
+  uint64_t tx_edge_us = 0;
+  int tx_bits = -1;               // of the word so far, -1 before a start bit
+  uint32_t tx_word = 0;
+
+  int8_t Motor() {
+    bool up = digitalRead(ASSERT_UP), down = digitalRead(ASSERT_DOWN);
+    return up != down ? (up ? 1 : -1) : tx_drive;
+  }
+
+  // A pin write of the firmware; words on LOGICDATA_TX are decoded like the
+  // firmware decodes the controller's: LOW is a 1, a long LOW a start bit
+  void PinOutput(uint64_t now, uint8_t pin, uint8_t val) {
+#ifdef LOGICDATA_TX
+    if (pin != LOGICDATA_TX)
+      return;
+    uint64_t d = now - tx_edge_us;
+    if (tx_level == LOW && d >= START_TIME) {
+      tx_bits = 0;
+      tx_word = 0;
+    } else if (tx_bits >= 0) {
+      for (uint64_t n = (d + 500) / 1000; n && tx_bits < 32; n--, tx_bits++)
+        tx_word = tx_word << 1 | (tx_level == LOW);
+      if (tx_bits == 32) {
+        Update(now);
+        Command(now, tx_word);
+        tx_bits = -1;
+      }
+    }
+    tx_level = val;
+    tx_edge_us = now;
+#endif
+  }
+
+  void Command(uint64_t now, uint32_t w) {
+    int cmd = -1;
+    for (int c = 0; c < LogicData::CMD_COUNT; c++) {
+      uint32_t cw = LogicData::CommandWord(LogicData::Command(c));
+      if (cw && (cw & ~1u) == (w & ~1u)) cmd = c;
+    }
+    if (cmd < 0 || !LogicData::CheckParity(w)) {
+      tx_errors++;
+      return;
+    }
+    tx_words[cmd]++;
+
+    tx_target = 0;
+    if (cmd == LogicData::CMD_STOP) {
+      tx_drive = 0;
+    } else if (cmd == LogicData::CMD_UP || cmd == LogicData::CMD_DOWN) {
+      tx_drive = cmd == LogicData::CMD_UP ? 1 : -1;
+      tx_drive_us = now;
+    } else {
+      tx_target = memory[cmd - LogicData::CMD_MEM1];
+      tx_drive = tx_target > height ? 1 : -1;
+    }
+  }
+
+  static uint32_t Word(uint8_t h) {
+    uint8_t r = 0;
+    for (int b = 0; b < 8; b++)
+      if (h & (1 << b)) r |= 0x80 >> b;
+    return LogicData::Parity(0x40600400u | (uint32_t(r) << 1));
+  }
+
+  // Queue one word: a start MARK, 32 bits MSB first, back to idle
+  void QueueWord(uint64_t t, uint8_t h) {
+    uint32_t w = Word(h);
+    edges.push_back({t, LOW});
+    t += 50000;
+    for (uint32_t m = 0x80000000u; m; m >>= 1, t += 1000)
+      edges.push_back({t, (w & m) ? LOW : HIGH});
+    edges.push_back({t, LOW});
+    edges.push_back({t + 1000, HIGH});
+  }
+
+  void Update(uint64_t now) {
+    // a handset that stops repeating up/down has been let go
+    if (tx_drive && !tx_target && now - tx_drive_us > hold_us)
+      tx_drive = 0;
+
+    int8_t motor = Motor();
+    if (motor) {
+      height += motor * speed * (now - last_us) / 1e6;
+      height = constrain(height, min_height, max_height);
+      if (tx_target && motor == tx_drive && (motor > 0 ? height >= tx_target : height <= tx_target)) {
+        height = tx_target;
+        tx_target = 0;
+        tx_drive = 0;
+      }
+      last_motion_us = now;
+      if (!reporting) next_word_us = now;
+      reporting = true;
+    } else if (reporting && now - last_motion_us > display_us) {
+      reporting = false;
+    }
+    last_us = now;
+
+    if (reporting && edges.empty() && now >= next_word_us) {
+      QueueWord(now, (uint8_t)(height + 0.5));
+      next_word_us = now + word_period_us;
+    }
+  }
+
+  uint64_t Next() {
+    return edges.empty() ? UINT64_MAX : edges.front().first;
+  }
+
+  void Fire(uint64_t now) {
+    while (!edges.empty() && edges.front().first <= now) {
+      level = edges.front().second;
+      host_pin_input(LOGICDATA_RX, level);
+      edges.pop_front();
+    }
+  }
+
+  // Report the height once, e.g. so the firmware learns it at start
+  void Announce(uint64_t now) {
+    reporting = true;
+    last_motion_us = now;
+    next_word_us = now;
+  }
+};
+
+#endif // DESK_MODEL_H
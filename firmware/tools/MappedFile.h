@@ -0,0 +1,50 @@
+// Read-only memory mapping of a whole file
+
+#ifndef TOOLS_MAPPED_FILE_H
+#define TOOLS_MAPPED_FILE_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct MappedFile {
+  const uint8_t * data = nullptr;
+  size_t size = 0;
+
+  bool open(const char * path) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+      perror(path);
+      return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+      perror(path);
+      ::close(fd);
+      return false;
+    }
+    size = st.st_size;
+    if (size) {
+      void * map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      if (map == MAP_FAILED) {
+        perror(path);
+        ::close(fd);
+        size = 0;
+        return false;
+      }
+      madvise(map, size, MADV_SEQUENTIAL);
+      data = static_cast<const uint8_t *>(map);
+    }
+    ::close(fd);
+    return true;
+  }
+
+  ~MappedFile() {
+    if (data) munmap(const_cast<uint8_t *>(data), size);
+  }
+};
+
+#endif // TOOLS_MAPPED_FILE_H
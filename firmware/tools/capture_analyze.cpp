@@ -0,0 +1,208 @@
+// Offline analyzer for LogicData edge captures (see lib/EdgeCapture/EdgeCapture.h)
+//
+// Feeds the captured edges through the same LogicData::ReadTrace decoder the
+// firmware runs and reports decoded words, errors and bit timing.
+//
+// Build (from firmware/):
+//   g++ -O2 -Itools/host -Ilib/LogicData -Ilib/EdgeCapture -o capture_analyze
+//       tools/capture_analyze.cpp tools/host/Arduino.cpp
+//       lib/LogicData/LogicData.cpp lib/EdgeCapture/EdgeCapture.cpp
+//
+// Usage: capture_analyze [-v] [--raw] <capture file>...
+//   A capture file is the concatenation of the frames published to
+//   <MQTT_TOPIC>capture, e.g. `mosquitto_sub -t home/table/capture >> desk.cap`.
+//   Serial captures can be converted with `grep CAP | cut -d' ' -f2 | xxd -r -p`.
+//   --raw reads an unframed varint stream instead.
+
+#include <Arduino.h>
+#include <LogicData.h>
+#include <EdgeCapture.h>
+#include "frames.h"
+#include "MappedFile.h"
+
+#include <time.h>
+
+struct Stats {
+  FrameStats frames;
+  uint64_t bytes = 0;
+  uint64_t edges = 0;
+  uint64_t gaps = 0;
+  uint64_t idles = 0;
+  uint64_t truncated = 0;
+
+  uint64_t words = 0;
+  uint64_t numbers = 0;
+  uint64_t display = 0;
+  uint64_t unknown = 0;
+  uint64_t parity = 0;
+  uint64_t invalid = 0;
+  uint8_t min_height = 255;
+  uint8_t max_height = 0;
+
+  // single-bit pulses, used to estimate the real bit clock
+  uint64_t bit_count = 0;
+  uint64_t bit_sum = 0;
+  uint32_t bit_min = UINT32_MAX;
+  uint32_t bit_max = 0;
+  uint64_t width_hist[10] = {0}; // in bit times; last bucket is "longer"
+};
+
+static bool verbose = false;
+static LogicData logicData(-1);
+static Stats stats;
+
+static void on_word(uint32_t msg) {
+  stats.words++;
+  const char * type = LogicData::MsgType(msg);
+  if (!strcmp(type, "INVAL")) stats.invalid++;
+  else if (!strcmp(type, "PARIT")) stats.parity++;
+  else if (!strcmp(type, "NUMBR")) {
+    stats.numbers++;
+    uint8_t h = logicData.GetNumber(msg);
+    if (h < stats.min_height) stats.min_height = h;
+    if (h > stats.max_height) stats.max_height = h;
+  }
+  else if (!strcmp(type, "DISPL")) stats.display++;
+  else stats.unknown++;
+
+  if (verbose) {
+    printf("%10.3fms %s: %s\n", host_us / 1000.0, type, LogicData::Decode(msg));
+  }
+}
+
+static void on_edge(uint32_t delta) {
+  stats.edges++;
+  if (delta == BIG_IDLE) {
+    stats.idles++;
+  } else {
+    host_advance(delta);
+    uint32_t bits = (delta + 500) / 1000;
+    stats.width_hist[bits < 9 ? bits : 9]++;
+    if (bits == 1) {
+      stats.bit_count++;
+      stats.bit_sum += delta;
+      if (delta < stats.bit_min) stats.bit_min = delta;
+      if (delta > stats.bit_max) stats.bit_max = delta;
+    }
+  }
+
+  logicData.Inject(delta);
+  uint32_t msg;
+  while ((msg = logicData.ReadTrace())) {
+    on_word(msg);
+  }
+}
+
+// Decode an unframed varint stream; returns bytes consumed
+static size_t feed_stream(const uint8_t * p, size_t len, bool & gap) {
+  size_t off = 0;
+  while (off < len) {
+    uint32_t v;
+    size_t n = EdgeCapture::Decode(p + off, len - off, v);
+    if (!n) break;
+    off += n;
+    if (v == CAPTURE_GAP) {
+      stats.gaps++;
+      gap = true;
+      continue;
+    }
+    on_edge(gap ? BIG_IDLE : v);
+    gap = false;
+  }
+  return off;
+}
+
+static void analyze(const uint8_t * p, size_t len, bool raw) {
+  bool gap = false;
+  stats.bytes += len;
+
+  if (raw) {
+    if (feed_stream(p, len, gap) != len) stats.truncated++;
+    return;
+  }
+
+  // Frames may split a varint, so collect payload into a small carry buffer
+  uint8_t carry[8 + FRAME_MAX_PAYLOAD];
+  size_t carried = 0;
+
+  size_t off = for_each_frame(p, len, CAPTURE_FRAME_MAGIC, stats.frames,
+    [&](const uint8_t * data, size_t n, bool lost) {
+      if (lost) {
+        carried = 0;  // partial varint belongs to a lost frame
+        gap = true;
+      }
+      memcpy(carry + carried, data, n);
+      carried += n;
+      size_t used = feed_stream(carry, carried, gap);
+      memmove(carry, carry + used, carried - used);
+      carried -= used;
+    });
+  if (carried || off != len) stats.truncated++;
+}
+
+static bool analyze_file(const char * path, bool raw) {
+  MappedFile f;
+  if (!f.open(path)) return false;
+  analyze(f.data, f.size, raw);
+  return true;
+}
+
+static void report(double seconds) {
+  printf("input:   %llu bytes, %llu frames, %llu lost, %llu bad, %llu truncated\n",
+         (unsigned long long)stats.bytes, (unsigned long long)stats.frames.frames,
+         (unsigned long long)stats.frames.lost, (unsigned long long)stats.frames.bad,
+         (unsigned long long)stats.truncated);
+  printf("edges:   %llu (%llu idle, %llu capture gaps), %.3fs of signal\n",
+         (unsigned long long)stats.edges, (unsigned long long)stats.idles,
+         (unsigned long long)stats.gaps, host_us / 1e6);
+  printf("words:   %llu: %llu NUMBR, %llu DISPL, %llu UKNWN, %llu PARIT, %llu INVAL\n",
+         (unsigned long long)stats.words, (unsigned long long)stats.numbers,
+         (unsigned long long)stats.display, (unsigned long long)stats.unknown,
+         (unsigned long long)stats.parity, (unsigned long long)stats.invalid);
+  if (stats.numbers) {
+    printf("height:  %u..%u cm\n", stats.min_height, stats.max_height);
+  }
+  if (stats.bit_count) {
+    printf("bit:     mean %.1fus, min %uus, max %uus over %llu pulses\n",
+           double(stats.bit_sum) / stats.bit_count, stats.bit_min, stats.bit_max,
+           (unsigned long long)stats.bit_count);
+  }
+  printf("widths: ");
+  for (int i = 0; i < 10; i++) {
+    printf(" %s%d:%llu", i == 9 ? ">" : "", i == 9 ? 8 : i, (unsigned long long)stats.width_hist[i]);
+  }
+  printf("\n");
+  if (seconds > 0) {
+    printf("speed:   %.1f MB/s, %.1f Medges/s\n",
+           stats.bytes / seconds / 1e6, stats.edges / seconds / 1e6);
+  }
+}
+
+int main(int argc, char ** argv) {
+  bool raw = false;
+  int files = 0;
+  int failed = 0;
+
+  struct timespec t0, t1;
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-v")) {
+      verbose = true;
+    } else if (!strcmp(argv[i], "--raw")) {
+      raw = true;
+    } else {
+      files++;
+      if (!analyze_file(argv[i], raw)) failed++;
+    }
+  }
+
+  if (!files) {
+    fprintf(stderr, "usage: %s [-v] [--raw] <capture file>...\n", argv[0]);
+    return 2;
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  report((t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9);
+  return failed ? 1 : 0;
+}
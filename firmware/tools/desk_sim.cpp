@@ -0,0 +1,179 @@
+// Runs the firmware in real time on the host against a simulated desk
+// (DeskModel.h), so its network interfaces can be tried over loopback, e.g.
+// the local endpoint with tools/local_client or OTA updates with tools/ota_pack.
+//
+// Build (from firmware/):
+//   g++ -O2 -D ENABLE_LOCAL_ENDPOINT -Itools/host -Itools/host/config -Ilib/LogicData
+//       -Ilib/Logging -Ilib/ProtocolLearner -Ilib/MotionSupervisor -Ilib/DeskState
+//       -Ilib/FlashLog -Ilib/CommandCoalescer -Ilib/CommandQueue -Ilib/Backoff -Ilib/MotionModel
+//       -Ilib/FastPin -Ilib/DutyCycle -Ilib/PublishPolicy -Ilib/LocalEndpoint
+//       -Ilib/HeightHistory
+//       -o desk_sim tools/desk_sim.cpp src/main.cpp lib/*/*.cpp tools/host/*.cpp
+//
+// Usage: desk_sim [-v] [-t] [--height cm] [--speed cm/s] [--seconds N] [--ota-port N]
+//                 [--tx-test]
+//   -v echoes Serial, -t prints pin writes and publishes. --ota-port takes
+//   OTA updates on that UDP port of 127.0.0.1 (8266 on the desk); the
+//   images are counted, not run.
+//   --tx-test runs up, down, stop and a memory recall in transmit mode, as
+//   fast as it can, and fails unless the desk followed the handset commands;
+//   it needs a build with -D HOST_LOGICDATA_TX.
+//
+// The firmware's idle naps pass in the simulation too, ended by the desk's
+// edges, and the busy/idle duty cycle is printed at the end.
+
+#include <Arduino.h>
+#include <Credentials.h>
+#include <coredecls.h>
+#include <PubSubClient.h>
+#include <DutyCycle.h>
+#include <ArduinoOTA.h>
+#include "DeskModel.h"
+
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+
+// firmware entry points and globals (src/main.cpp)
+void setup();
+void loop();
+extern DutyCycle duty;
+
+static const uint32_t loop_us = 250;
+
+static DeskModel desk;
+static uint64_t wall0;
+static uint64_t start;
+static bool realtime = true;
+
+static uint64_t wall_us() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000ull + t.tv_nsec / 1000;
+}
+
+// Run the desk and the clock up to virtual time until, in real time
+static void run_until(uint64_t until) {
+  while (desk.Next() <= until) {
+    if (desk.Next() > host_us) host_advance(desk.Next() - host_us);
+    desk.Fire(host_us);
+  }
+  if (until > host_us) host_advance(until - host_us);
+  desk.Update(host_us);
+
+  // keep virtual time with the wall clock
+  if (!realtime) return;
+  int64_t ahead = int64_t(host_us - start) - int64_t(wall_us() - wall0);
+  if (ahead > 1000) usleep(ahead);
+}
+
+// A nap of the firmware: time passes in 1 ms steps until an edge ends it
+static void idle(uint32_t timeout_ms, const std::function<bool()> & blocked) {
+  uint64_t end = host_us + timeout_ms * 1000ull;
+  while (host_us < end && blocked())
+    run_until(std::min(end, host_us + 1000));
+}
+
+#ifdef LOGICDATA_TX
+static void run_for(uint32_t ms) {
+  uint64_t end = host_us + ms * 1000ull;
+  while (host_us < end) {
+    loop();
+    run_until(host_us + loop_us);
+  }
+}
+
+static int failed = 0;
+
+static void check(bool ok, const char * what) {
+  printf("%s %s (%.1f cm)\n", ok ? "ok  " : "FAIL", what, desk.height);
+  if (!ok) failed++;
+}
+
+// Drives the firmware through the moves of a handset in transmit mode and
+// checks that the desk saw the command words and did what they say
+static int tx_test() {
+  realtime = false;
+  // the bits are clocked by the timer, which is never quite on time
+  host_timer1_jitter_us = 150;
+  run_for(3000);
+
+  double h = desk.height;
+  uint32_t stops = desk.tx_words[LogicData::CMD_STOP];
+  host_pin_input(BTN_UP, HIGH);
+  run_for(2000);
+  check(desk.tx_words[LogicData::CMD_UP] >= 5 && desk.height > h + 5, "up is repeated while the button is held");
+  host_pin_input(BTN_UP, LOW);
+  run_for(500);
+  check(desk.tx_words[LogicData::CMD_STOP] == stops + 1 && !desk.Motor(), "releasing the button sends stop");
+  h = desk.height;
+  run_for(2000);
+  check(desk.height == h, "the desk stays stopped");
+
+  host_pin_input(BTN_DOWN, HIGH);
+  run_for(2000);
+  check(desk.tx_words[LogicData::CMD_DOWN] >= 5 && desk.height < h - 5, "down is repeated while the button is held");
+  host_pin_input(BTN_DOWN, LOW);
+  run_for(500);
+  check(desk.tx_words[LogicData::CMD_STOP] == stops + 2 && !desk.Motor(), "releasing the button sends stop");
+
+  const char * mem = "mem4";
+  host_mqtt_deliver(MQTT_TOPIC "cmd", (const uint8_t *)mem, strlen(mem));
+  run_for(30000);
+  check(desk.tx_words[LogicData::CMD_MEM4] == 1 && fabs(desk.height - desk.memory[3]) < 0.5, "mem4 recalls the memory position");
+
+  check(desk.tx_errors == 0, "every word decoded");
+  return failed ? 1 : 0;
+}
+#else
+static int tx_test() {
+  fprintf(stderr, "--tx-test needs a build with -D HOST_LOGICDATA_TX\n");
+  return 2;
+}
+#endif
+
+int main(int argc, char ** argv) {
+  uint32_t seconds = 0;
+  bool test = false;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-v")) {
+      host_serial_echo = true;
+    } else if (!strcmp(argv[i], "-t")) {
+      host_trace = stdout;
+    } else if (!strcmp(argv[i], "--height") && i + 1 < argc) {
+      desk.height = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--speed") && i + 1 < argc) {
+      desk.speed = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--seconds") && i + 1 < argc) {
+      seconds = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--ota-port") && i + 1 < argc) {
+      host_ota_port = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--tx-test")) {
+      test = true;
+    } else {
+      fprintf(stderr, "usage: %s [-v] [-t] [--height cm] [--speed cm/s] [--seconds N] [--ota-port N] [--tx-test]\n", argv[0]);
+      return 2;
+    }
+  }
+  setvbuf(stdout, nullptr, _IOLBF, 0);
+
+  host_pin_output = [](uint8_t pin, uint8_t val) { desk.PinOutput(host_us, pin, val); };
+  setup();
+  desk.Announce(host_us);
+  host_idle = idle;
+  if (test)
+    return tx_test();
+
+  wall0 = wall_us();
+  start = host_us;
+  while (!seconds || host_us - start < seconds * 1000000ull) {
+    loop();
+    run_until(host_us + loop_us);
+  }
+  printf("busy %u%% of the last %u s, %u naps, %u ended by an event\n",
+         (unsigned)duty.Busy(), DUTY_WINDOW_MS / 1000, (unsigned)duty.naps, (unsigned)duty.wakeups);
+  if (host_ota_port)
+    printf("%u OTA updates, last image %u bytes\n", (unsigned)host_ota_updates, (unsigned)host_ota_image.size());
+  return 0;
+}
@@ -0,0 +1,385 @@
+// Runs a fleet of simulated desks against a real MQTT broker and reports how
+// the broker and the firmware hold up: publish rates, reconnect storms and
+// the latency of commands from publish to the desk's events.
+//
+// Every desk is the firmware plus a DeskModel in its own process (the
+// firmware keeps its state in globals), connected to the broker with its own
+// client id under <prefix>desk<n>/. The parent process generates the command
+// load: "set" messages with an id at the given rate, spread over random desks,
+// timed until the desk reports them accepted and completed on its event
+// topic. --drop-at cuts every desk's connection at once, like a broker
+// restart, to show how the reconnects spread out.
+//
+// --group sends a group move to every desk at that interval, starting --lead
+// ms ahead and arriving --span ms after the start, and reports how far apart
+// the desks arrived. The desks move at different speeds, which they learn
+// from their moves, so the first group moves arrive further apart.
+//
+// Build (from firmware/):
+//   g++ -O2 -Itools/host -Itools/host/config -Ilib/LogicData -Ilib/Logging
+//       -Ilib/ProtocolLearner -Ilib/MotionSupervisor -Ilib/DeskState -Ilib/FlashLog
+//       -Ilib/CommandCoalescer -Ilib/CommandQueue -Ilib/Backoff -Ilib/MotionModel
+//       -Ilib/FastPin -Ilib/DutyCycle -Ilib/PublishPolicy -Ilib/HeightHistory
+//       -o fleet_sim tools/fleet_sim.cpp src/main.cpp lib/*/*.cpp tools/host/*.cpp
+//
+// Usage: fleet_sim [--desks N] [--broker addr] [--port N] [--seconds S]
+//                  [--rate commands/s] [--drop-at S] [--prefix topic/]
+//                  [--group S] [--lead ms] [--span ms]
+//   e.g. `fleet_sim --desks 200 --rate 20 --seconds 60 --drop-at 20` against
+//   a local mosquitto.
+
+#include <Arduino.h>
+#include <PubSubClient.h>
+#include <Credentials.h>
+#include "DeskModel.h"
+
+#include <algorithm>
+#include <map>
+#include <vector>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/wait.h>
+#include <sys/time.h>
+
+// firmware entry points and globals (src/main.cpp)
+void setup();
+void loop();
+extern PubSubClient mqttClient;
+
+static const uint32_t loop_us = 1000;
+
+#define GROUP_TOPIC "robodesk/group"  // MQTT_GROUP_TOPIC of the firmware
+
+struct Options {
+  int desks = 50;
+  const char * broker = "127.0.0.1";
+  uint16_t port = 1883;
+  uint32_t seconds = 30;
+  double rate = 5;
+  double drop_at = -1;
+  const char * prefix = "fleet/";
+  double group = 0;
+  uint32_t lead = 1000;
+  uint32_t span = 12000;
+};
+
+static uint64_t wall0;
+
+static uint64_t wall_us() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1000000ull + t.tv_nsec / 1000;
+}
+
+static double elapsed_ms() {
+  return (wall_us() - wall0) / 1e3;
+}
+
+// One desk: runs until the end, then writes its connect attempts to out as
+// "<ms> <ok>" lines
+static void run_desk(const Options & o, int n, FILE * out) {
+  DeskModel desk;
+  srand(getpid());
+  desk.height = 80 + random(40);
+  desk.speed = 3.0 + random(16) / 10.0;
+  host_chip_id = n + 1;
+  host_mqtt_remap(MQTT_TOPIC, (String(o.prefix) + "desk" + String(n) + "/").c_str());
+  host_mqtt_live = true;
+
+  setup();
+  mqttClient.setServer(o.broker, o.port);
+  desk.Announce(host_us);
+
+  std::vector<std::pair<double, bool>> attempts;
+  uint32_t connects = 0, failures = 0;
+  bool dropped = o.drop_at < 0;
+  uint64_t start = host_us;
+  uint64_t start_wall = wall_us();
+  while (host_us - start < o.seconds * 1000000ull) {
+    if (!dropped && elapsed_ms() >= o.drop_at * 1000) {
+      mqttClient.drop();
+      dropped = true;
+    }
+
+    loop();
+    if (host_mqtt_connects != connects || host_mqtt_failures != failures) {
+      attempts.push_back({elapsed_ms(), host_mqtt_connects != connects});
+      connects = host_mqtt_connects;
+      failures = host_mqtt_failures;
+    }
+
+    uint64_t next = host_us + loop_us;
+    while (desk.Next() <= next) {
+      if (desk.Next() > host_us) host_advance(desk.Next() - host_us);
+      desk.Fire(host_us);
+    }
+    if (next > host_us) host_advance(next - host_us);
+    desk.Update(host_us);
+
+    int64_t ahead = int64_t(host_us - start) - int64_t(wall_us() - start_wall);
+    if (ahead > 1000) usleep(ahead);
+  }
+
+  for (auto & a : attempts)
+    fprintf(out, "%.1f %d\n", a.first, a.second);
+  fprintf(out, "publishes %u\n", host_mqtt_publishes);
+}
+
+struct Command {
+  int desk;
+  double sent;
+  double accepted = -1;
+  double done = -1;
+  const char * outcome = nullptr;
+};
+
+static std::map<std::string, Command> sent;
+
+struct GroupMove {
+  double arrive;  // planned
+  std::vector<double> arrivals;
+  int failed = 0;
+};
+
+static std::map<std::string, GroupMove> groups;
+static std::string prefix;
+static std::vector<uint32_t> per_second;  // messages from the desks
+
+static void on_message(char * topic, uint8_t * payload, unsigned int length) {
+  double now = elapsed_ms();
+  std::string t(topic);
+  if (t.size() > 4 && !t.compare(t.size() - 4, 4, "/set"))
+    return;  // our own load
+  size_t second = now / 1000;
+  if (per_second.size() <= second) per_second.resize(second + 1);
+  per_second[second]++;
+
+  if (t.size() < 6 || t.compare(t.size() - 6, 6, "/event"))
+    return;
+  std::string p((const char *)payload, length);
+  size_t space = p.find(' ');
+  auto c = sent.find(p.substr(0, space));
+  std::string event = p.substr(space + 1, p.find(' ', space + 1) - space - 1);
+  auto g = groups.find(p.substr(0, space));
+  if (g != groups.end()) {
+    if (event == "completed")
+      g->second.arrivals.push_back(now);
+    else if (event != "accepted")
+      g->second.failed++;
+    return;
+  }
+  if (space == std::string::npos || c == sent.end())
+    return;
+  if (event == "accepted") {
+    c->second.accepted = now;
+  } else if (!c->second.outcome) {
+    c->second.done = now;
+    c->second.outcome = event == "completed" ? "completed" : event == "superseded" ? "superseded" : "failed";
+  }
+}
+
+static void print_latency(const char * name, std::vector<double> v) {
+  if (v.empty()) {
+    printf("%-10s none\n", name);
+    return;
+  }
+  std::sort(v.begin(), v.end());
+  auto at = [&](double q) { return v[std::min(v.size() - 1, size_t(q * v.size()))]; };
+  printf("%-10s p50 %.1f ms  p90 %.1f  p99 %.1f  max %.1f  (%zu)\n", name, at(0.5), at(0.9), at(0.99), v.back(), v.size());
+}
+
+// Connect storm in [from, to): attempts, the peak per 100 ms and when the
+// last desk that had been cut off was back
+static void print_storm(const char * name, std::vector<std::pair<double, bool>> & attempts, double from, double to, int desks) {
+  std::map<int, int> windows;
+  int count = 0, ok = 0;
+  double last_ok = from;
+  for (auto & a : attempts) {
+    if (a.first < from || a.first >= to) continue;
+    count++;
+    windows[int(a.first / 100)]++;
+    if (a.second) {
+      ok++;
+      last_ok = a.first;
+    }
+  }
+  int peak = 0;
+  for (auto & w : windows) peak = std::max(peak, w.second);
+  printf("%-10s %d attempts, peak %d per 100 ms, %d/%d desks connected, the last after %.1f s\n",
+         name, count, peak, ok, desks, (last_ok - from) / 1e3);
+}
+
+int main(int argc, char ** argv) {
+  Options o;
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--desks") && i + 1 < argc) {
+      o.desks = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--broker") && i + 1 < argc) {
+      o.broker = argv[++i];
+    } else if (!strcmp(argv[i], "--port") && i + 1 < argc) {
+      o.port = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--seconds") && i + 1 < argc) {
+      o.seconds = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--rate") && i + 1 < argc) {
+      o.rate = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--drop-at") && i + 1 < argc) {
+      o.drop_at = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--prefix") && i + 1 < argc) {
+      o.prefix = argv[++i];
+    } else if (!strcmp(argv[i], "--group") && i + 1 < argc) {
+      o.group = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--lead") && i + 1 < argc) {
+      o.lead = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--span") && i + 1 < argc) {
+      o.span = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "usage: %s [--desks N] [--broker addr] [--port N] [--seconds S]\n"
+                      "       [--rate commands/s] [--drop-at S] [--prefix topic/]\n"
+                      "       [--group S] [--lead ms] [--span ms]\n", argv[0]);
+      return 2;
+    }
+  }
+  setvbuf(stdout, nullptr, _IOLBF, 0);
+  prefix = o.prefix;
+  wall0 = wall_us();
+
+  std::vector<FILE *> results;
+  for (int n = 0; n < o.desks; n++) {
+    int fd[2];
+    if (pipe(fd)) {
+      perror("pipe");
+      return 1;
+    }
+    pid_t pid = fork();
+    if (pid == 0) {
+      close(fd[0]);
+      FILE * out = fdopen(fd[1], "w");
+      run_desk(o, n, out);
+      fclose(out);
+      _exit(0);
+    }
+    close(fd[1]);
+    if (pid < 0) {
+      perror("fork");
+      return 1;
+    }
+    results.push_back(fdopen(fd[0], "r"));
+  }
+
+  // the load generator is a client of its own
+  host_mqtt_live = true;
+  PubSubClient load;
+  load.setServer(o.broker, o.port);
+  load.setCallback(on_message);
+  srand(getpid());
+
+  uint32_t next_id = 0;
+  double next_command = 2000;  // let the desks come up
+  double next_group = 2000;
+  double last_connect = -1000;
+  while (elapsed_ms() < o.seconds * 1000.0) {
+    double now = elapsed_ms();
+    if (!load.connected() && now - last_connect > 1000) {
+      last_connect = now;
+      if (load.connect("fleet_sim")) load.subscribe((prefix + "#").c_str());
+    }
+    load.loop();
+
+    if (o.rate > 0 && now >= next_command && now < (o.seconds - 5) * 1000.0) {
+      next_command += 1000 / o.rate;
+      if (load.connected()) {
+        Command c;
+        c.desk = random(o.desks);
+        c.sent = now;
+        char id[16], payload[32], topic[128];
+        snprintf(id, sizeof(id), "f%u", (unsigned)next_id++);
+        snprintf(payload, sizeof(payload), "%s:%d", id, int(80 + random(40)));
+        snprintf(topic, sizeof(topic), "%sdesk%d/set", o.prefix, c.desk);
+        sent[id] = c;
+        load.publish(topic, payload);
+      }
+    }
+    if (o.group > 0 && now >= next_group && now + o.lead + o.span < o.seconds * 1000.0) {
+      next_group += o.group * 1000;
+      if (load.connected()) {
+        struct timeval tv;
+        gettimeofday(&tv, nullptr);
+        char id[16], payload[64];
+        snprintf(id, sizeof(id), "g%u", (unsigned)groups.size());
+        snprintf(payload, sizeof(payload), "%s:%d %llu %u", id, int(80 + random(40)),
+                 (unsigned long long)(tv.tv_sec * 1000ull + tv.tv_usec / 1000 + o.lead), o.span);
+        groups[id].arrive = now + o.lead + o.span;
+        load.publish(GROUP_TOPIC, payload);
+      }
+    }
+    poll(nullptr, 0, 1);
+  }
+  load.disconnect();
+
+  // results come in as the desks finish
+  std::vector<std::pair<double, bool>> attempts;
+  uint64_t publishes = 0;
+  for (FILE * f : results) {
+    char line[64];
+    while (fgets(line, sizeof(line), f)) {
+      double ms;
+      int ok;
+      unsigned n;
+      if (sscanf(line, "publishes %u", &n) == 1)
+        publishes += n;
+      else if (sscanf(line, "%lf %d", &ms, &ok) == 2)
+        attempts.push_back({ms, ok != 0});
+    }
+    fclose(f);
+  }
+  while (wait(nullptr) > 0) {}
+
+  printf("fleet:     %d desks, %u s, %.1f commands/s, broker %s:%u\n", o.desks, o.seconds, o.rate, o.broker, o.port);
+
+  uint64_t seen = 0;
+  uint32_t peak = 0;
+  for (uint32_t n : per_second) {
+    seen += n;
+    peak = std::max(peak, n);
+  }
+  printf("publishes: %llu sent by the desks, %llu seen, %.1f/s mean, %u/s peak\n",
+         (unsigned long long)publishes, (unsigned long long)seen, double(seen) / o.seconds, peak);
+
+  double drop = o.drop_at < 0 ? o.seconds * 1000.0 : o.drop_at * 1000;
+  print_storm("start:", attempts, 0, drop, o.desks);
+  if (o.drop_at >= 0)
+    print_storm("reconnect:", attempts, drop, o.seconds * 1000.0, o.desks);
+
+  std::vector<double> accepted, completed;
+  std::map<std::string, int> outcomes;
+  for (auto & c : sent) {
+    if (c.second.accepted >= 0) accepted.push_back(c.second.accepted - c.second.sent);
+    if (c.second.outcome && !strcmp(c.second.outcome, "completed")) completed.push_back(c.second.done - c.second.sent);
+    outcomes[c.second.outcome ? c.second.outcome : c.second.accepted >= 0 ? "running" : "lost"]++;
+  }
+  printf("commands:  %zu sent", sent.size());
+  for (auto & n : outcomes) printf(", %d %s", n.second, n.first.c_str());
+  printf("\n");
+  print_latency("accepted:", accepted);
+  print_latency("completed:", completed);
+
+  // arrivals of desks that did not move at all (already there) count as on time
+  std::vector<double> spreads, errors;
+  for (auto & g : groups) {
+    auto & a = g.second.arrivals;
+    if (a.empty()) continue;
+    std::sort(a.begin(), a.end());
+    double spread = a.back() - a.front();
+    spreads.push_back(spread);
+    for (double t : a) errors.push_back(fabs(t - g.second.arrive));
+    printf("%-10s %s: %zu/%d desks arrived, %d failed, spread %.0f ms, %+.0f..%+.0f ms from the plan\n",
+           "group:", g.first.c_str(), a.size(), o.desks, g.second.failed, spread,
+           a.front() - g.second.arrive, a.back() - g.second.arrive);
+  }
+  if (!groups.empty()) {
+    print_latency("spread:", spreads);
+    print_latency("off plan:", errors);
+  }
+  return 0;
+}
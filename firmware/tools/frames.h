@@ -0,0 +1,46 @@
+// Walks the frames sent by EdgeCapture and SessionRecorder:
+// magic (uint8), seq (uint8), len (uint16 LE), len bytes of payload.
+
+#ifndef TOOLS_FRAMES_H
+#define TOOLS_FRAMES_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define FRAME_HEADER 4
+#define FRAME_MAX_PAYLOAD 1024
+
+struct FrameStats {
+  uint64_t frames = 0;
+  uint64_t lost = 0;   // missing sequence numbers
+  uint64_t bad = 0;    // bytes skipped while looking for a frame header
+};
+
+// Calls on_payload(data, len, lost_before) for each frame with the given
+// magic; returns the number of bytes consumed
+template <class F>
+size_t for_each_frame(const uint8_t * p, size_t len, uint8_t magic, FrameStats & st, F on_payload) {
+  int last_seq = -1;
+  size_t off = 0;
+
+  while (off + FRAME_HEADER <= len) {
+    size_t n = p[off + 2] | (p[off + 3] << 8);
+    if (p[off] != magic || n > FRAME_MAX_PAYLOAD || off + FRAME_HEADER + n > len) {
+      st.bad++;
+      off++;
+      continue;
+    }
+
+    uint8_t seq = p[off + 1];
+    bool lost = last_seq >= 0 && seq != uint8_t(last_seq + 1);
+    if (lost) st.lost += uint8_t(seq - last_seq - 1);
+    last_seq = seq;
+    st.frames++;
+
+    on_payload(p + off + FRAME_HEADER, n, lost);
+    off += FRAME_HEADER + n;
+  }
+  return off;
+}
+
+#endif // TOOLS_FRAMES_H
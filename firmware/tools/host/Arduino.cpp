@@ -0,0 +1,192 @@
+#include "Arduino.h"
+#include "coredecls.h"
+#include <stdarg.h>
+#include <inttypes.h>
+#include <atomic>
+#include <mutex>
+
+#define HOST_PINS 64
+
+uint64_t host_us = 0;
+FILE * host_trace = nullptr;
+bool host_serial_echo = false;
+HostSerial Serial;
+EspClass ESP;
+uint32_t host_chip_id = 0xd35c01;
+void (*host_idle)(uint32_t timeout_ms, const std::function<bool()> & blocked) = nullptr;
+void (*host_pin_output)(uint8_t pin, uint8_t val) = nullptr;
+
+static void (*host_timer1_isr)();
+static bool host_timer1_enabled = false;
+static bool host_timer1_loop = false;
+static uint32_t host_timer1_div = 1;
+static uint64_t host_timer1_period = 0;  // us
+static uint64_t host_timer1_due = 0;
+static uint32_t host_timer1_late = 0;     // us, of the next firing
+uint32_t host_timer1_jitter_us = 0;
+
+static uint8_t host_rtc_memory[HOST_RTC_USER_MEMORY];
+static uint8_t host_flash[HOST_FLASH_SECTORS * 4096];
+uint32_t host_flash_erases[HOST_FLASH_SECTORS];
+static bool host_flash_blank = (memset(host_flash, 0xff, sizeof(host_flash)), true);
+
+static std::recursive_mutex host_interrupt_lock;
+
+void noInterrupts() { host_interrupt_lock.lock(); }
+void interrupts() { host_interrupt_lock.unlock(); }
+
+static std::atomic<uint8_t> host_pins[HOST_PINS];  // read by the firmware while a tool thread drives them
+static uint8_t host_modes[HOST_PINS];
+static void (*host_isr[HOST_PINS])();
+
+void host_advance(uint32_t us) {
+  uint64_t target = host_us + us;
+  while (host_timer1_enabled && host_timer1_period && host_timer1_due + host_timer1_late <= target) {
+    host_us = host_timer1_due + host_timer1_late;
+    host_timer1_due += host_timer1_period;
+    if (host_timer1_jitter_us) {
+      // a fixed LCG, so runs stay reproducible
+      static uint32_t r = 1;
+      r = r * 1103515245 + 12345;
+      host_timer1_late = (r >> 8) % (host_timer1_jitter_us + 1);
+    }
+    if (!host_timer1_loop) host_timer1_enabled = false;
+    if (host_timer1_isr) {
+      noInterrupts();
+      host_timer1_isr();
+      interrupts();
+    }
+  }
+  host_us = target;
+}
+
+void timer1_attachInterrupt(void (*isr)()) {
+  host_timer1_isr = isr;
+}
+
+void timer1_enable(uint8_t divider, uint8_t, uint8_t reload) {
+  host_timer1_div = divider == TIM_DIV256 ? 256 : divider == TIM_DIV16 ? 16 : 1;
+  host_timer1_loop = reload == TIM_LOOP;
+  host_timer1_enabled = true;
+}
+
+void timer1_disable() {
+  host_timer1_enabled = false;
+}
+
+void timer1_write(uint32_t ticks) {
+  // 80 MHz base clock
+  host_timer1_period = uint64_t(ticks) * host_timer1_div / 80;
+  host_timer1_due = host_us + host_timer1_period;
+}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  host_modes[pin % HOST_PINS] = mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t val) {
+  pin %= HOST_PINS;
+  val = val ? HIGH : LOW;
+  bool changed = host_modes[pin] == OUTPUT && host_pins[pin] != val;
+  if (changed) {
+    host_trace_line("pin", "%u %u", pin, val);
+  }
+  host_pins[pin] = val;
+  if (changed && host_pin_output) {
+    host_pin_output(pin, val);
+  }
+}
+
+int digitalRead(uint8_t pin) {
+  return host_pins[pin % HOST_PINS];
+}
+
+void attachInterrupt(int pin, void (*isr)(), int) {
+  host_isr[pin % HOST_PINS] = isr;
+}
+
+void detachInterrupt(int pin) {
+  host_isr[pin % HOST_PINS] = nullptr;
+}
+
+void host_pin_input(uint8_t pin, uint8_t val) {
+  pin %= HOST_PINS;
+  val = val ? HIGH : LOW;
+  std::lock_guard<std::recursive_mutex> in_interrupt(host_interrupt_lock);
+  if (host_pins[pin] == val) return;
+  host_pins[pin] = val;
+  if (host_isr[pin]) host_isr[pin]();
+}
+
+void host_trace_line(const char * kind, const char * fmt, ...) {
+  if (!host_trace) return;
+  fprintf(host_trace, "%10" PRIu64 " %s ", host_us, kind);
+  va_list args;
+  va_start(args, fmt);
+  vfprintf(host_trace, fmt, args);
+  va_end(args);
+  fputc('\n', host_trace);
+}
+
+size_t Print::print(long n, int base) {
+  if (base == DEC) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), "%ld", n);
+    return print(buf);
+  }
+  return print((unsigned long)n, base);
+}
+
+size_t Print::print(unsigned long n, int base) {
+  char buf[8 * sizeof(long) + 1];
+  char * p = buf + sizeof(buf) - 1;
+  *p = 0;
+  if (base < 2) base = DEC;
+  do {
+    int d = n % base;
+    *--p = d < 10 ? '0' + d : 'A' + d - 10;
+    n /= base;
+  } while (n);
+  return print(p);
+}
+
+size_t HostSerial::write(uint8_t c) {
+  if (host_serial_echo) fputc(c, stderr);
+  return 1;
+}
+
+uint32_t EspClass::getChipId() {
+  return host_chip_id;
+}
+
+bool EspClass::rtcUserMemoryRead(uint32_t offset, uint32_t * data, size_t size) {
+  if (offset * 4 + size > sizeof(host_rtc_memory)) return false;
+  memcpy(data, host_rtc_memory + offset * 4, size);
+  return true;
+}
+
+bool EspClass::rtcUserMemoryWrite(uint32_t offset, uint32_t * data, size_t size) {
+  if (offset * 4 + size > sizeof(host_rtc_memory)) return false;
+  memcpy(host_rtc_memory + offset * 4, data, size);
+  return true;
+}
+
+bool EspClass::flashEraseSector(uint32_t sector) {
+  if (sector >= HOST_FLASH_SECTORS) return false;
+  memset(host_flash + sector * 4096, 0xff, 4096);
+  host_flash_erases[sector]++;
+  return true;
+}
+
+bool EspClass::flashWrite(uint32_t offset, uint32_t * data, size_t size) {
+  if ((offset | size) & 3 || offset + size > sizeof(host_flash)) return false;
+  const uint8_t * p = (const uint8_t *)data;
+  for (size_t i = 0; i < size; i++) host_flash[offset + i] &= p[i];
+  return true;
+}
+
+bool EspClass::flashRead(uint32_t offset, uint32_t * data, size_t size) {
+  if ((offset | size) & 3 || offset + size > sizeof(host_flash)) return false;
+  memcpy(data, host_flash + offset, size);
+  return true;
+}
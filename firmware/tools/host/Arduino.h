@@ -0,0 +1,215 @@
+// Minimal Arduino stand-in for building the firmware on a host.
+// Time is virtual: tools advance it explicitly through host_advance(),
+// and delay()/delayMicroseconds() advance it as well.
+
+#ifndef HOST_ARDUINO_H
+#define HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdlib.h>
+#include <math.h>
+#include <string>
+
+#define IRAM_ATTR
+#define ICACHE_RAM_ATTR
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define CHANGE 3
+#define RISING 4
+#define FALLING 5
+#define DEC 10
+#define HEX 16
+#define OCT 8
+#define BIN 2
+
+#define constrain(amt,low,high) ((amt)<(low)?(low):((amt)>(high)?(high):(amt)))
+
+typedef uint8_t byte;
+
+extern uint64_t host_us;
+
+inline unsigned long micros() { return (uint32_t)host_us; }
+inline unsigned long millis() { return (uint32_t)(host_us / 1000); }
+
+// Advance the virtual clock, running timer1 callbacks that fall due
+void host_advance(uint32_t us);
+inline void delay(unsigned long ms) { host_advance(ms * 1000); }
+inline void delayMicroseconds(unsigned int us) { host_advance(us); }
+inline void yield() {}
+
+// random() draws from rand(); tools seed it with randomSeed() or srand()
+inline long random(long howbig) { return howbig > 0 ? rand() % howbig : 0; }
+inline long random(long howsmall, long howbig) { return howsmall < howbig ? howsmall + random(howbig - howsmall) : howsmall; }
+inline void randomSeed(unsigned long seed) { srand(seed); }
+
+// SNTP; the host clock is already set
+inline void configTime(int, int, const char *, const char * = nullptr, const char * = nullptr) {}
+
+// Interrupt handlers (pin changes, timer1) run with a recursive lock held,
+// which noInterrupts() takes as well, so a tool may drive the "interrupts"
+// from a thread of their own, like tools/isr_stress, and the firmware's
+// critical sections hold against them as they do on the ESP8266.
+void noInterrupts();
+void interrupts();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t val);
+int digitalRead(uint8_t pin);
+
+inline int digitalPinToInterrupt(int pin) { return pin; }
+void attachInterrupt(int pin, void (*isr)(), int mode);
+void detachInterrupt(int pin);
+
+// ESP8266 timer1, driven by the virtual clock
+#define TIM_DIV1 0
+#define TIM_DIV16 1
+#define TIM_DIV256 3
+#define TIM_EDGE 0
+#define TIM_LEVEL 1
+#define TIM_SINGLE 0
+#define TIM_LOOP 1
+
+void timer1_attachInterrupt(void (*isr)());
+void timer1_enable(uint8_t divider, uint8_t int_type, uint8_t reload);
+void timer1_disable();
+void timer1_write(uint32_t ticks);
+
+// Interrupt latency: each timer1 firing comes up to this late, without
+// moving the ones after it
+extern uint32_t host_timer1_jitter_us;
+
+// Drive an input pin from the outside and run its interrupt handler;
+// may be called from a thread other than the firmware's
+void host_pin_input(uint8_t pin, uint8_t val);
+
+// Called on every change of an OUTPUT pin, at host_us, e.g. for a simulated
+// device listening on the pin
+extern void (*host_pin_output)(uint8_t pin, uint8_t val);
+
+// Output trace: pin writes on OUTPUT pins and MQTT publishes are logged here
+// with their virtual timestamp when set
+extern FILE * host_trace;
+void host_trace_line(const char * kind, const char * fmt, ...);
+
+class String
+{
+  std::string s;
+
+  public:
+
+  String() {}
+  String(const char * c) : s(c ? c : "") {}
+  String(const std::string & c) : s(c) {}
+  String(char c) : s(1, c) {}
+  String(unsigned char v) : s(std::to_string(v)) {}
+  String(int v) : s(std::to_string(v)) {}
+  String(unsigned int v) : s(std::to_string(v)) {}
+  String(long v) : s(std::to_string(v)) {}
+  String(unsigned long v) : s(std::to_string(v)) {}
+
+  const char * c_str() const { return s.c_str(); }
+  unsigned int length() const { return s.length(); }
+  char operator[](unsigned int i) const { return i < s.length() ? s[i] : 0; }
+
+  String & operator+=(const String & o) { s += o.s; return *this; }
+  String & operator+=(const char * o) { s += o; return *this; }
+  String & operator+=(char c) { s += c; return *this; }
+
+  friend String operator+(const String & a, const String & b) { return String(a.s + b.s); }
+  friend String operator+(const String & a, const char * b) { return String(a.s + b); }
+
+  bool operator==(const String & o) const { return s == o.s; }
+  bool operator==(const char * o) const { return s == o; }
+  bool operator!=(const String & o) const { return s != o.s; }
+  bool operator!=(const char * o) const { return s != o; }
+
+  bool startsWith(const String & p) const { return s.compare(0, p.s.length(), p.s) == 0; }
+  bool endsWith(const String & p) const {
+    return s.length() >= p.s.length() && s.compare(s.length() - p.s.length(), p.s.length(), p.s) == 0;
+  }
+  int indexOf(char c, unsigned int from = 0) const {
+    size_t r = s.find(c, from);
+    return r == std::string::npos ? -1 : (int)r;
+  }
+  String substring(unsigned int from) const { return from < s.length() ? String(s.substr(from)) : String(); }
+  String substring(unsigned int from, unsigned int to) const {
+    return from < s.length() && to > from ? String(s.substr(from, to - from)) : String();
+  }
+  long toInt() const { return atol(s.c_str()); }
+  void trim() {
+    size_t b = s.find_first_not_of(" \t\r\n"), e = s.find_last_not_of(" \t\r\n");
+    s = b == std::string::npos ? std::string() : s.substr(b, e - b + 1);
+  }
+};
+
+class Print
+{
+  public:
+
+  virtual ~Print() {}
+  virtual size_t write(uint8_t c) = 0;
+  virtual size_t write(const uint8_t * buf, size_t n) {
+    for (size_t i = 0; i < n; i++) write(buf[i]);
+    return n;
+  }
+
+  size_t print(const char * str) { return str ? write((const uint8_t *)str, strlen(str)) : 0; }
+  size_t print(const String & str) { return print(str.c_str()); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(long n, int base = DEC);
+  size_t print(int n, int base = DEC) { return print((long)n, base); }
+  size_t print(unsigned long n, int base = DEC);
+  size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+  size_t println(const char * str = "") { return print(str) + print("\r\n"); }
+};
+
+class Stream : public Print
+{
+  public:
+
+  virtual int available() { return 0; }
+  virtual int read() { return -1; }
+};
+
+// Serial output goes to stderr when host_serial_echo is set
+class HostSerial : public Stream
+{
+  public:
+
+  void begin(long) {}
+  size_t write(uint8_t c) override;
+  using Print::write;
+};
+
+extern HostSerial Serial;
+extern bool host_serial_echo;
+
+// ESP8266 system functions; RTC user memory and flash are kept in RAM.
+// Flash behaves like NOR flash: writes can only clear bits, erases set them.
+#define HOST_RTC_USER_MEMORY 512
+#define HOST_FLASH_SECTORS 16
+
+class EspClass
+{
+  public:
+
+  bool rtcUserMemoryRead(uint32_t offset, uint32_t * data, size_t size);
+  bool rtcUserMemoryWrite(uint32_t offset, uint32_t * data, size_t size);
+  String getResetReason() { return String("Power on"); }
+  uint32_t getChipId();
+
+  bool flashEraseSector(uint32_t sector);
+  bool flashWrite(uint32_t offset, uint32_t * data, size_t size);
+  bool flashRead(uint32_t offset, uint32_t * data, size_t size);
+};
+
+extern EspClass ESP;
+extern uint32_t host_flash_erases[HOST_FLASH_SECTORS];
+extern uint32_t host_chip_id;
+
+#endif // HOST_ARDUINO_H
@@ -0,0 +1,117 @@
+#include "ArduinoOTA.h"
+#include "MD5Builder.h"
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+
+#define HOST_OTA_TIMEOUT_MS 5000
+
+ArduinoOTAClass ArduinoOTA;
+uint16_t host_ota_port = 0;
+std::vector<uint8_t> host_ota_image;
+uint32_t host_ota_updates = 0;
+
+void ArduinoOTAClass::begin() {
+  if (!host_ota_port || udp >= 0)
+    return;
+  udp = socket(AF_INET, SOCK_DGRAM, 0);
+  int one = 1;
+  setsockopt(udp, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in a = {};
+  a.sin_family = AF_INET;
+  a.sin_port = htons(host_ota_port);
+  a.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(udp, (struct sockaddr *)&a, sizeof(a))) {
+    close(udp);
+    udp = -1;
+    return;
+  }
+  fcntl(udp, F_SETFL, fcntl(udp, F_GETFL) | O_NONBLOCK);
+}
+
+void ArduinoOTAClass::fail(ota_error_t error) {
+  if (error_cb) error_cb(error);
+}
+
+void ArduinoOTAClass::handle() {
+  if (udp < 0)
+    return;
+
+  // invitation: "<command> <port> <size> <md5>"
+  char buf[128];
+  struct sockaddr_in from;
+  socklen_t from_len = sizeof(from);
+  ssize_t n = recvfrom(udp, buf, sizeof(buf) - 1, 0, (struct sockaddr *)&from, &from_len);
+  if (n <= 0)
+    return;
+  buf[n] = 0;
+
+  int cmd;
+  unsigned port, size;
+  char md5[33];
+  if (sscanf(buf, "%d %u %u %32s", &cmd, &port, &size, md5) != 4 || strlen(md5) != 32)
+    return;
+  command = cmd;
+  sendto(udp, "OK", 2, 0, (struct sockaddr *)&from, from_len);
+  receive(from.sin_addr.s_addr, port, size, md5);
+}
+
+void ArduinoOTAClass::receive(uint32_t addr, uint16_t port, uint32_t size, const char * md5) {
+  if (start_cb) start_cb();
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in a = {};
+  a.sin_family = AF_INET;
+  a.sin_port = htons(port);
+  a.sin_addr.s_addr = addr;
+  if (fd < 0 || connect(fd, (struct sockaddr *)&a, sizeof(a))) {
+    if (fd >= 0) close(fd);
+    fail(OTA_CONNECT_ERROR);
+    return;
+  }
+
+  std::vector<uint8_t> image;
+  MD5Builder sum;
+  sum.begin();
+  uint8_t chunk[1460];
+  while (image.size() < size) {
+    struct pollfd p = {fd, POLLIN, 0};
+    ssize_t n = poll(&p, 1, HOST_OTA_TIMEOUT_MS) == 1 ? recv(fd, chunk, sizeof(chunk), 0) : -1;
+    if (n <= 0) {
+      close(fd);
+      fail(OTA_RECEIVE_ERROR);
+      return;
+    }
+    // the Updater takes a plain image or a gzip one, which the bootloader unpacks
+    if (image.empty() && command == U_FLASH && chunk[0] != 0xe9 && !(n > 1 && chunk[0] == 0x1f && chunk[1] == 0x8b)) {
+      close(fd);
+      fail(OTA_RECEIVE_ERROR);
+      return;
+    }
+    image.insert(image.end(), chunk, chunk + n);
+    sum.add(chunk, n);
+    if (progress_cb) progress_cb(image.size(), size);
+    char ack[12];
+    int len = snprintf(ack, sizeof(ack), "%u", (unsigned)n);
+    send(fd, ack, len, MSG_NOSIGNAL);
+  }
+
+  char got[33];
+  sum.calculate();
+  sum.getChars(got);
+  if (image.size() != size || strcmp(got, md5)) {
+    close(fd);
+    fail(OTA_END_ERROR);
+    return;
+  }
+  send(fd, "OK", 2, MSG_NOSIGNAL);
+  close(fd);
+
+  host_ota_image.swap(image);
+  host_ota_updates++;
+  // the desk would reboot into the new image here
+  if (end_cb) end_cb();
+}
@@ -0,0 +1,58 @@
+// Host stand-in for ArduinoOTA.
+//
+// With host_ota_port set, begin() listens for espota invitations on that UDP
+// port of the loopback interface and handle() receives the image like the
+// ESP8266 does: it connects back to the sender, reports every chunk, checks
+// the image header (a plain 0xE9 image or a gzip one) and the MD5, and keeps
+// the image in host_ota_image instead of flashing it. Like on the desk,
+// handle() blocks for the whole transfer. Push images with tools/ota_pack.
+// Without host_ota_port it never receives an update.
+
+#ifndef HOST_ARDUINOOTA_H
+#define HOST_ARDUINOOTA_H
+
+#include <Arduino.h>
+#include <functional>
+#include <vector>
+
+#define U_FLASH 0
+#define U_FS 100
+#define U_SPIFFS U_FS
+
+typedef enum {
+  OTA_AUTH_ERROR,
+  OTA_BEGIN_ERROR,
+  OTA_CONNECT_ERROR,
+  OTA_RECEIVE_ERROR,
+  OTA_END_ERROR
+} ota_error_t;
+
+class ArduinoOTAClass
+{
+  std::function<void()> start_cb, end_cb;
+  std::function<void(unsigned int, unsigned int)> progress_cb;
+  std::function<void(ota_error_t)> error_cb;
+  int udp = -1;
+  int command = U_FLASH;
+
+  void receive(uint32_t addr, uint16_t port, uint32_t size, const char * md5);
+  void fail(ota_error_t error);
+
+  public:
+
+  void onStart(std::function<void()> f) { start_cb = f; }
+  void onEnd(std::function<void()> f) { end_cb = f; }
+  void onProgress(std::function<void(unsigned int, unsigned int)> f) { progress_cb = f; }
+  void onError(std::function<void(ota_error_t)> f) { error_cb = f; }
+  void setHostname(const char *) {}
+  void begin();
+  void handle();
+  int getCommand() { return command; }
+};
+
+extern ArduinoOTAClass ArduinoOTA;
+extern uint16_t host_ota_port;                // 0: no updates
+extern std::vector<uint8_t> host_ota_image;   // the last image received
+extern uint32_t host_ota_updates;
+
+#endif // HOST_ARDUINOOTA_H
@@ -0,0 +1,117 @@
+#include "ESP8266WiFi.h"
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <errno.h>
+
+HostWiFi WiFi;
+bool host_wifi_up = true;
+
+int HostWiFi::status() {
+  return host_wifi_up ? WL_CONNECTED : WL_DISCONNECTED;
+}
+
+struct WiFiClient::Socket {
+  int fd;
+  explicit Socket(int fd) : fd(fd) {}
+  ~Socket() { if (fd >= 0) close(fd); }
+};
+
+static void host_nonblocking(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+WiFiClient::WiFiClient(int fd) : sock(std::make_shared<Socket>(fd)) {
+  host_nonblocking(fd);
+}
+
+int WiFiClient::connect(const char * host, uint16_t port) {
+  struct addrinfo hints = {}, * res;
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  char service[8];
+  snprintf(service, sizeof(service), "%u", port);
+  if (getaddrinfo(host, service, &hints, &res)) return 0;
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  int ok = fd >= 0 && ::connect(fd, res->ai_addr, res->ai_addrlen) == 0;
+  freeaddrinfo(res);
+  if (!ok) {
+    if (fd >= 0) close(fd);
+    return 0;
+  }
+  *this = WiFiClient(fd);
+  return 1;
+}
+
+size_t WiFiClient::write(const uint8_t * buf, size_t n) {
+  if (!sock) return 0;
+  ssize_t r = send(sock->fd, buf, n, MSG_NOSIGNAL | MSG_DONTWAIT);
+  return r > 0 ? r : 0;
+}
+
+int WiFiClient::available() {
+  int n = 0;
+  if (!sock || ioctl(sock->fd, FIONREAD, &n)) return 0;
+  return n;
+}
+
+int WiFiClient::read() {
+  uint8_t c;
+  return sock && recv(sock->fd, &c, 1, MSG_DONTWAIT) == 1 ? c : -1;
+}
+
+int WiFiClient::availableForWrite() {
+  struct pollfd p = {sock ? sock->fd : -1, POLLOUT, 0};
+  return sock && poll(&p, 1, 0) == 1 && (p.revents & POLLOUT) ? 1460 : 0;
+}
+
+uint8_t WiFiClient::connected() {
+  if (!sock) return 0;
+  uint8_t c;
+  ssize_t r = recv(sock->fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+  if (r > 0 || (r < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))) return 1;
+  sock.reset();
+  return 0;
+}
+
+void WiFiClient::stop() {
+  sock.reset();
+}
+
+void WiFiClient::setNoDelay(bool nodelay) {
+  int v = nodelay;
+  if (sock) setsockopt(sock->fd, IPPROTO_TCP, TCP_NODELAY, &v, sizeof(v));
+}
+
+void WiFiServer::begin() {
+  fd = socket(AF_INET, SOCK_STREAM, 0);
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  struct sockaddr_in addr = {};
+  addr.sin_family = AF_INET;
+  addr.sin_port = htons(port);
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, 4)) {
+    perror("WiFiServer");
+    stop();
+    return;
+  }
+  host_nonblocking(fd);
+}
+
+WiFiClient WiFiServer::available() {
+  int c = fd >= 0 ? accept(fd, nullptr, nullptr) : -1;
+  return c >= 0 ? WiFiClient(c) : WiFiClient();
+}
+
+void WiFiServer::stop() {
+  if (fd >= 0) close(fd);
+  fd = -1;
+}
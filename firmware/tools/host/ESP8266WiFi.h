@@ -0,0 +1,103 @@
+// Host stand-in for the ESP8266WiFi library; the network is up while
+// host_wifi_up is set.
+
+#ifndef HOST_ESP8266WIFI_H
+#define HOST_ESP8266WIFI_H
+
+#include <Arduino.h>
+#include <memory>
+
+#define WIFI_STA 1
+#define WL_CONNECTED 3
+#define WL_DISCONNECTED 6
+
+enum WiFiSleepType { WIFI_NONE_SLEEP, WIFI_LIGHT_SLEEP, WIFI_MODEM_SLEEP };
+
+class IPAddress
+{
+  uint8_t a[4];
+
+  public:
+
+  IPAddress() : a{0, 0, 0, 0} {}
+  IPAddress(uint8_t a0, uint8_t a1, uint8_t a2, uint8_t a3) : a{a0, a1, a2, a3} {}
+  IPAddress(const uint8_t * address) : a{address[0], address[1], address[2], address[3]} {}
+
+  String toString() const {
+    char buf[16];
+    snprintf(buf, sizeof(buf), "%u.%u.%u.%u", a[0], a[1], a[2], a[3]);
+    return String(buf);
+  }
+};
+
+class HostWiFi
+{
+  public:
+
+  void mode(int) {}
+  void persistent(bool) {}
+  void config(IPAddress, IPAddress, IPAddress, IPAddress) {}
+  void setAutoReconnect(bool) {}
+  void hostname(const char *) {}
+  bool setSleepMode(WiFiSleepType) { return true; }
+  void begin(const char *, const char *) {}
+  int status();
+  IPAddress localIP() { return IPAddress(127, 0, 0, 1); }
+};
+
+extern HostWiFi WiFi;
+extern bool host_wifi_up;
+
+class Client : public Stream
+{
+  public:
+
+  size_t write(uint8_t) override { return 1; }
+  using Print::write;
+  virtual uint8_t connected() { return 0; }
+  virtual void stop() {}
+};
+
+// TCP client on a real, non-blocking host socket, so the firmware can be
+// reached over loopback. Copies share the socket, like on the ESP8266.
+class WiFiClient : public Client
+{
+  struct Socket;
+  std::shared_ptr<Socket> sock;
+
+  public:
+
+  WiFiClient() {}
+  explicit WiFiClient(int fd);
+
+  // Blocking connect, for host tools
+  int connect(const char * host, uint16_t port);
+
+  size_t write(uint8_t c) override { return write(&c, 1); }
+  size_t write(const uint8_t * buf, size_t n) override;
+  int available() override;
+  int read() override;
+  int availableForWrite();
+  uint8_t connected() override;
+  void stop() override;
+  void setNoDelay(bool nodelay);
+  explicit operator bool() { return connected(); }
+};
+
+class WiFiServer
+{
+  int fd = -1;
+  uint16_t port;
+
+  public:
+
+  WiFiServer(uint16_t port) : port(port) {}
+  ~WiFiServer() { stop(); }
+
+  void begin();
+  void setNoDelay(bool) {}
+  WiFiClient available();
+  void stop();
+};
+
+#endif // HOST_ESP8266WIFI_H
@@ -0,0 +1,28 @@
+// Host stand-in for the ESP8266 core's MD5Builder, used by the OTA stand-in
+// and tools/ota_pack to check images like the Updater does.
+
+#ifndef HOST_MD5BUILDER_H
+#define HOST_MD5BUILDER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+class MD5Builder
+{
+  uint32_t h[4];
+  uint64_t len;
+  uint8_t block[64];
+  uint8_t digest[16];
+
+  void transform(const uint8_t * p);
+
+  public:
+
+  void begin();
+  void add(const uint8_t * data, size_t n);
+  void calculate();
+  // 32 lowercase hex digits and a terminator
+  void getChars(char * out);
+};
+
+#endif // HOST_MD5BUILDER_H
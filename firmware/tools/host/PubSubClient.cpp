@@ -0,0 +1,224 @@
+#include "PubSubClient.h"
+#include <poll.h>
+
+bool host_mqtt_broker_up = true;
+bool host_mqtt_live = false;
+uint32_t host_mqtt_publishes = 0;
+uint32_t host_mqtt_connects = 0;
+uint32_t host_mqtt_failures = 0;
+
+static PubSubClient * host_mqtt_client = nullptr;
+static std::string remap_from, remap_to;
+
+#define MQTT_KEEPALIVE 15  // s
+
+static std::string mqtt_string(const char * s, size_t len) {
+  std::string r;
+  r += char(len >> 8);
+  r += char(len & 0xff);
+  r.append(s, len);
+  return r;
+}
+
+static std::string mqtt_string(const char * s) {
+  return mqtt_string(s, strlen(s));
+}
+
+void host_mqtt_remap(const char * from, const char * to) {
+  remap_from = from;
+  remap_to = to;
+}
+
+// The topic with a leading from replaced by to
+static std::string remapped(const char * topic, const std::string & from, const std::string & to) {
+  if (from.empty() || strncmp(topic, from.c_str(), from.size()))
+    return topic;
+  return to + (topic + from.size());
+}
+
+// Write all of buf, waiting for the socket for up to a second
+static bool write_all(WiFiClient & net, const std::string & buf) {
+  size_t done = 0;
+  for (int tries = 0; done < buf.size() && tries < 100 && net.connected(); tries++) {
+    done += net.write((const uint8_t *)buf.data() + done, buf.size() - done);
+    if (done < buf.size()) poll(nullptr, 0, 10);
+  }
+  return done == buf.size();
+}
+
+bool PubSubClient::send(uint8_t header, const std::string & body) {
+  std::string packet(1, char(header));
+  size_t len = body.size();
+  do {
+    uint8_t b = len % 128;
+    len /= 128;
+    packet += char(len ? b | 0x80 : b);
+  } while (len);
+  packet += body;
+  if (!write_all(net, packet)) {
+    drop();
+    return false;
+  }
+  last_out = millis();
+  return true;
+}
+
+bool PubSubClient::connect(const char * id, const char * user, const char * pass,
+                           const char * willTopic, uint8_t willQos, bool willRetain, const char * willMessage) {
+  if (!host_mqtt_live) {
+    if (!host_mqtt_broker_up) {
+      host_mqtt_failures++;
+      return false;
+    }
+    up = true;
+    host_mqtt_client = this;
+    host_mqtt_connects++;
+    host_trace_line("con", "%s", id);
+    return true;
+  }
+
+  drop();
+  rx.clear();
+  if (!net.connect(server.c_str(), port)) {
+    host_mqtt_failures++;
+    return false;
+  }
+
+  uint8_t flags = 0x02;  // clean session
+  std::string payload = mqtt_string(id);
+  if (willTopic) {
+    flags |= 0x04 | (willQos << 3) | (willRetain ? 0x20 : 0);
+    payload += mqtt_string(remapped(willTopic, remap_from, remap_to).c_str()) + mqtt_string(willMessage);
+  }
+  if (user) {
+    flags |= 0x80;
+    payload += mqtt_string(user);
+  }
+  if (pass) {
+    flags |= 0x40;
+    payload += mqtt_string(pass);
+  }
+  std::string body = mqtt_string("MQTT") + char(4) + char(flags) + char(0) + char(MQTT_KEEPALIVE) + payload;
+
+  // wait for the CONNACK, like the library does
+  uint8_t ack[4];
+  size_t got = 0;
+  if (send(0x10, body)) {
+    for (int tries = 0; got < 4 && tries < 200 && net.connected(); tries++) {
+      while (got < 4 && net.available()) ack[got++] = net.read();
+      if (got < 4) poll(nullptr, 0, 10);
+    }
+  }
+  if (got < 4 || ack[0] != 0x20 || ack[3] != 0) {
+    drop();
+    host_mqtt_failures++;
+    return false;
+  }
+  up = true;
+  host_mqtt_client = this;
+  host_mqtt_connects++;
+  return true;
+}
+
+void PubSubClient::disconnect() {
+  if (host_mqtt_live && up)
+    send(0xe0, "");
+  drop();
+}
+
+bool PubSubClient::connected() {
+  if (host_mqtt_live && up && !net.connected())
+    up = false;
+  return up;
+}
+
+// Hand one complete incoming packet to the callback; false if none is buffered
+bool PubSubClient::dispatch() {
+  size_t len = 0, i = 1;
+  for (int shift = 0; ; shift += 7, i++) {
+    if (i >= rx.size()) return false;
+    len |= size_t(rx[i] & 0x7f) << shift;
+    if (!(rx[i] & 0x80)) break;
+  }
+  i++;
+  if (rx.size() < i + len) return false;
+
+  uint8_t header = rx[0];
+  if ((header >> 4) == 3 && len >= 2 && callback) {
+    size_t tlen = (rx[i] << 8) | rx[i + 1];
+    size_t skip = 2 + tlen + ((header & 0x06) ? 2 : 0);  // packet id for QoS > 0
+    if (skip <= len) {
+      std::string topic = remapped(std::string((const char *)&rx[i + 2], tlen).c_str(), remap_to, remap_from);
+      std::vector<uint8_t> payload(rx.begin() + i + skip, rx.begin() + i + len);
+      payload.push_back(0);
+      callback((char *)topic.c_str(), payload.data(), len - skip);
+    }
+  }
+  rx.erase(rx.begin(), rx.begin() + i + len);
+  return true;
+}
+
+bool PubSubClient::loop() {
+  if (!host_mqtt_live || !connected())
+    return up;
+
+  int n;
+  while ((n = net.available()) > 0) {
+    while (n--) rx.push_back(net.read());
+  }
+  while (dispatch()) {}
+
+  if (millis() - last_out > MQTT_KEEPALIVE * 1000 / 2)
+    send(0xc0, "");  // PINGREQ
+  return connected();
+}
+
+bool PubSubClient::subscribe(const char * topic) {
+  if (!host_mqtt_live) {
+    host_trace_line("sub", "%s", topic);
+    return up;
+  }
+  return up && send(0x82, std::string("\0\1", 2) + mqtt_string(remapped(topic, remap_from, remap_to).c_str()) + char(0));
+}
+
+bool PubSubClient::publish(const char * topic, const char * payload) {
+  return publish(topic, payload, false);
+}
+
+bool PubSubClient::publish(const char * topic, const char * payload, bool retained) {
+  if (!up) return false;
+  if (host_mqtt_live)
+    return publish(topic, (const uint8_t *)payload, strlen(payload), retained);
+  host_mqtt_publishes++;
+  host_trace_line(retained ? "ret" : "pub", "%s %s", topic, payload);
+  return true;
+}
+
+bool PubSubClient::publish(const char * topic, const uint8_t * payload, unsigned int length, bool retained) {
+  if (!up) return false;
+  host_mqtt_publishes++;
+  if (host_mqtt_live)
+    return send(retained ? 0x31 : 0x30, mqtt_string(remapped(topic, remap_from, remap_to).c_str()) +
+                                        std::string((const char *)payload, length));
+
+  std::string hex;
+  char buf[3];
+  for (unsigned int i = 0; i < length; i++) {
+    snprintf(buf, sizeof(buf), "%02x", payload[i]);
+    hex += buf;
+  }
+  host_trace_line(retained ? "ret" : "pub", "%s %s", topic, hex.c_str());
+  return true;
+}
+
+void host_mqtt_deliver(const char * topic, const uint8_t * payload, unsigned int length) {
+  if (!host_mqtt_client || !host_mqtt_client->connected() || !host_mqtt_client->callback) return;
+
+  // PubSubClient hands out its own buffer, which the firmware may write a terminator into
+  char t[256];
+  uint8_t p[512];
+  snprintf(t, sizeof(t), "%s", topic);
+  if (length > sizeof(p) - 1) length = sizeof(p) - 1;
+  memcpy(p, payload, length);
+  host_mqtt_client->callback(t, p, length);
+}
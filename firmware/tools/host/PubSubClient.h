@@ -0,0 +1,78 @@
+// Host stand-in for PubSubClient. Publishes are written to the host trace,
+// incoming messages are injected with host_mqtt_deliver().
+//
+// With host_mqtt_live set the client speaks MQTT 3.1.1 (QoS 0 only) to a
+// real broker over a host socket instead, so tools can run the firmware
+// against e.g. a local mosquitto.
+
+#ifndef HOST_PUBSUBCLIENT_H
+#define HOST_PUBSUBCLIENT_H
+
+#include <Arduino.h>
+#include <ESP8266WiFi.h>
+#include <vector>
+
+#define MQTT_CALLBACK_SIGNATURE void (*callback)(char*, uint8_t*, unsigned int)
+
+class PubSubClient
+{
+  bool up = false;
+
+  // live mode
+  std::string server;
+  uint16_t port = 1883;
+  WiFiClient net;
+  std::vector<uint8_t> rx;
+  uint32_t last_out = 0;
+
+  bool send(uint8_t header, const std::string & body);
+  bool dispatch();
+
+  public:
+
+  MQTT_CALLBACK_SIGNATURE = nullptr;
+
+  PubSubClient() {}
+  PubSubClient(Client &) {}
+
+  PubSubClient & setServer(const char * host, uint16_t port) { server = host; this->port = port; return *this; }
+  PubSubClient & setCallback(MQTT_CALLBACK_SIGNATURE) { this->callback = callback; return *this; }
+  bool setBufferSize(uint16_t) { return true; }
+
+  bool connect(const char * id, const char * user, const char * pass,
+               const char * willTopic, uint8_t willQos, bool willRetain, const char * willMessage);
+  bool connect(const char * id) { return connect(id, nullptr, nullptr, nullptr, 0, false, nullptr); }
+  void disconnect();
+  bool connected();
+  bool loop();
+  int state() { return up ? 0 : -1; }
+
+  bool subscribe(const char * topic);
+  bool publish(const char * topic, const char * payload);
+  bool publish(const char * topic, const char * payload, bool retained);
+  bool publish(const char * topic, const uint8_t * payload, unsigned int length, bool retained);
+
+  // Drop the connection without a DISCONNECT, like a broker restart
+  void drop() { net.stop(); up = false; }
+};
+
+// Broker availability; connect() fails while this is false
+extern bool host_mqtt_broker_up;
+
+// Talk to the broker given to setServer() instead of writing the trace
+extern bool host_mqtt_live;
+
+// Live mode: topics starting with from go to the broker starting with to, and
+// back; the firmware's topics are compile-time constants, this gives every
+// process of a host tool a prefix of its own
+void host_mqtt_remap(const char * from, const char * to);
+
+// Deliver a message to the callback of the last connected client
+void host_mqtt_deliver(const char * topic, const uint8_t * payload, unsigned int length);
+
+// Counters over all clients, for host tools
+extern uint32_t host_mqtt_publishes;
+extern uint32_t host_mqtt_connects;
+extern uint32_t host_mqtt_failures;
+
+#endif // HOST_PUBSUBCLIENT_H
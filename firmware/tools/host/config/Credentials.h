@@ -0,0 +1,14 @@
+#ifndef CREDENTIALS_H
+#define CREDENTIALS_H
+
+// Fixed credentials for host builds, so traces do not depend on local settings
+
+#define WIFI_SSID "host"
+#define WIFI_PSK "host"
+#define MQTT_BROKER "127.0.0.1"
+#define MQTT_PORT 1883
+#define MQTT_USER nullptr
+#define MQTT_PASS nullptr
+#define MQTT_TOPIC "home/table/"
+
+#endif // CREDENTIALS_H
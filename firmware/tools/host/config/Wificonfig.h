@@ -0,0 +1 @@
+// Host builds use the default (DHCP) network setup
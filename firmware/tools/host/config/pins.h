@@ -0,0 +1,27 @@
+#ifndef PINS_H
+#define PINS_H
+
+// Fixed pin map for host builds, so traces do not depend on local settings
+
+#define ASSERT_UP 12
+#define ASSERT_DOWN 14
+
+#define BTN_UP 4
+#define BTN_DOWN 5
+
+#define LOGICDATA_RX 13
+
+// Transmit mode, for desk_sim --tx-test (build with -D HOST_LOGICDATA_TX).
+// The command words are made up for DeskModel, not taken from a handset.
+#ifdef HOST_LOGICDATA_TX
+#define LOGICDATA_TX 15
+#define LOGICDATA_CMD_STOP 0x40621000
+#define LOGICDATA_CMD_UP 0x40622000
+#define LOGICDATA_CMD_DOWN 0x40623000
+#define LOGICDATA_CMD_MEM1 0x40624000
+#define LOGICDATA_CMD_MEM2 0x40625000
+#define LOGICDATA_CMD_MEM3 0x40626000
+#define LOGICDATA_CMD_MEM4 0x40627000
+#endif
+
+#endif // PINS_H
@@ -0,0 +1,20 @@
+// Host stand-in for the core's esp_delay(): waits until blocked() returns
+// false or the timeout passed. Time only passes if a tool installs
+// host_idle and lets it pass there; otherwise the wait returns right away,
+// as if an event had ended it.
+
+#ifndef HOST_COREDECLS_H
+#define HOST_COREDECLS_H
+
+#include <Arduino.h>
+#include <functional>
+
+extern void (*host_idle)(uint32_t timeout_ms, const std::function<bool()> & blocked);
+
+template <typename T>
+void esp_delay(const uint32_t timeout_ms, T && blocked, const uint32_t) {
+  if (host_idle)
+    host_idle(timeout_ms, blocked);
+}
+
+#endif // HOST_COREDECLS_H
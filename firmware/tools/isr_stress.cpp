@@ -0,0 +1,212 @@
+// Stress test for the handoff between LogicData::PinChange, which runs in the
+// pin interrupt, and ReadTrace in the main loop.
+//
+// The "interrupt" runs on a thread of its own: it plays LogicData words as
+// pin edges into the real interrupt handler, by default at 20 times the
+// desk's 1kbps (--speed, 0 for as fast as it can), with jitter on the bit
+// timing and relay glitches, 5 per 1000 edges by default. It runs the idle
+// detection of the timer interrupt every 10ms of its clock; one word in
+// eight follows a long idle. The main thread decodes with ReadTrace like
+// loop() does and checks every word against the words sent. Words may be
+// lost when the decoder falls behind and the queue overflows, but a word
+// that was never sent is a corrupted word and fails the run.
+//
+// The host stand-in runs interrupt handlers under the lock noInterrupts()
+// takes, so the firmware's critical sections are exercised for real; build
+// it with ThreadSanitizer as well to find accesses outside of them.
+//
+// Build (from firmware/):
+//   g++ -O2 -Itools/host -Itools/host/config -Ilib/LogicData -o isr_stress
+//       tools/isr_stress.cpp tools/host/Arduino.cpp lib/LogicData/LogicData.cpp
+// ThreadSanitizer build: the same with -O1 -g -fsanitize=thread -o isr_stress_tsan
+//
+// Usage: isr_stress [--seconds S] [--speed x] [--jitter us] [--glitch permille]
+//                   [--read-delay us] [--seed N]
+//   --read-delay sleeps between reads to make the queue overflow under the
+//   decoder; a long run is e.g. `isr_stress --seconds 600 --glitch 20`, and
+//   `--speed 0` floods the queue to exercise overruns.
+
+#include <Arduino.h>
+#include <LogicData.h>
+#include <pins.h>
+#include "DeskModel.h"
+
+#include <atomic>
+#include <random>
+#include <thread>
+#include <time.h>
+#include <unistd.h>
+
+#define SENT_RING 4096  // words the checker can look back on
+#define SERVICE_US 10000  // period of the timer interrupt calling Service()
+
+static LogicData logicData(-1);
+
+static std::atomic<bool> running(true);
+static std::atomic<uint64_t> edges(0);
+static std::atomic<uint64_t> sent_count(0);
+static std::atomic<uint32_t> sent[SENT_RING];
+
+static double speed = 20;
+static uint32_t jitter_us = 50;
+static uint32_t glitch_permille = 5;
+static uint32_t read_delay_us = 0;
+static uint32_t seed = 1;
+
+static void IRAM_ATTR rx_isr() {
+  logicData.PinChange(digitalRead(LOGICDATA_RX));
+}
+
+static double wall_s() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec + t.tv_nsec / 1e9;
+}
+
+// The interrupt side: owns the virtual clock and the RX pin
+static void producer() {
+  std::mt19937 rng(seed);
+  double start = wall_s();
+  bool level = HIGH;
+  uint64_t ideal = host_us;  // of the last edge, without jitter
+  uint64_t serviced = host_us;
+
+  uint64_t start_us = host_us;
+
+  // the virtual clock runs speed times as fast as the wall clock; pacing it
+  // at every step, spikes included, gives the reader a chance at every state
+  auto advance = [&](uint32_t us) {
+    host_advance(us);
+    if (host_us - serviced >= SERVICE_US) {
+      serviced = host_us;
+      logicData.Service();
+    }
+    if (speed) {
+      double ahead = (host_us - start_us) / 1e6 / speed - (wall_s() - start);
+      if (ahead > 0) usleep(ahead * 1e6);
+    }
+  };
+
+  // the controller's bit clock is steady, only the edges wander around it
+  auto edge = [&](uint32_t after_us, bool to) {
+    ideal += after_us;
+    uint64_t at = ideal - jitter_us + rng() % (2 * jitter_us + 1);
+    uint32_t wait = at > host_us ? at - host_us : 1;
+    // a glitch splits the pulse with a spike the filter has to take back out
+    if (glitch_permille && rng() % 1000 < glitch_permille && wait > 200) {
+      advance(wait / 2);
+      host_pin_input(LOGICDATA_RX, !level);
+      // hold the spike for a moment of wall time, so the reader gets to see
+      // the pulse it cut short before the filter takes it back
+      if (speed) usleep(100);
+      advance(20);
+      host_pin_input(LOGICDATA_RX, level);
+      wait -= wait / 2 + 20;
+    }
+    while (wait > SERVICE_US) {
+      advance(SERVICE_US);
+      wait -= SERVICE_US;
+    }
+    advance(wait);
+    host_pin_input(LOGICDATA_RX, to);
+    level = to;
+    ++edges;
+  };
+  uint32_t pending = 0;  // since the last edge
+  while (running) {
+    uint32_t w = DeskModel::Word(62 + rng() % 67);
+    uint64_t k = sent_count.load(std::memory_order_relaxed);
+    sent[k % SENT_RING].store(w, std::memory_order_relaxed);
+    sent_count.store(k + 1, std::memory_order_release);
+
+    // idle, start MARK, 32 bits MSB first (MARK for 1), then back to idle
+    pending += rng() % 8 ? 2000 + rng() % 20000 : 50000 + rng() % 100000;
+    edge(pending, LOW);
+    pending = 50000;
+    for (uint32_t m = 0x80000000u; m; m >>= 1) {
+      bool to = (w & m) ? LOW : HIGH;
+      if (to != level) {
+        edge(pending, to);
+        pending = 0;
+      }
+      pending += 1000;
+    }
+    if (level != HIGH) {
+      edge(pending, HIGH);
+      pending = 0;
+    }
+  }
+}
+
+int main(int argc, char ** argv) {
+  double seconds = 5;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--seconds") && i + 1 < argc) {
+      seconds = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--speed") && i + 1 < argc) {
+      speed = atof(argv[++i]);
+    } else if (!strcmp(argv[i], "--jitter") && i + 1 < argc) {
+      jitter_us = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--glitch") && i + 1 < argc) {
+      glitch_permille = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--read-delay") && i + 1 < argc) {
+      read_delay_us = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--seed") && i + 1 < argc) {
+      seed = atoi(argv[++i]);
+    } else {
+      fprintf(stderr, "usage: %s [--seconds S] [--speed x] [--jitter us] [--glitch permille] "
+                      "[--read-delay us] [--seed N]\n", argv[0]);
+      return 2;
+    }
+  }
+  jitter_us = constrain(jitter_us, 0u, 200u);
+
+  pinMode(LOGICDATA_RX, INPUT);
+  host_pin_input(LOGICDATA_RX, HIGH);
+  attachInterrupt(digitalPinToInterrupt(LOGICDATA_RX), rx_isr, CHANGE);
+  logicData.Begin();
+
+  uint64_t reads = 0, decoded = 0, lost = 0, corrupted = 0, next = 0;
+  double start = wall_s();
+  std::thread isr(producer);
+
+  while (wall_s() - start < seconds) {
+    uint32_t w = logicData.ReadTrace();
+    reads++;
+    if (!w) {
+      if (read_delay_us) usleep(read_delay_us);
+      continue;
+    }
+    decoded++;
+
+    // the word must be one sent since the last match; the ones skipped were lost
+    uint64_t n = sent_count.load(std::memory_order_acquire);
+    if (n > SENT_RING && next < n - SENT_RING) {
+      lost += n - SENT_RING - next;
+      next = n - SENT_RING;
+    }
+    uint64_t k = next;
+    while (k < n && sent[k % SENT_RING].load(std::memory_order_relaxed) != w) k++;
+    if (k == n) {
+      if (corrupted++ < 10)
+        fprintf(stderr, "corrupted word %08x (%s)\n", w, LogicData::MsgType(w));
+      continue;
+    }
+    lost += k - next;
+    next = k + 1;
+    if (read_delay_us) usleep(read_delay_us);
+  }
+
+  running = false;
+  isr.join();
+  double s = wall_s() - start;
+
+  printf("edges    %llu (%.0f/s), %llu words sent (%.0f/s)\n", (unsigned long long)edges.load(), edges / s,
+         (unsigned long long)sent_count.load(), sent_count / s);
+  printf("decoded  %llu (%.0f/s), %llu lost, %llu corrupted\n", (unsigned long long)decoded, decoded / s,
+         (unsigned long long)lost, (unsigned long long)corrupted);
+  printf("reads    %llu, %u race retries (%.2f per 1000 words), %u glitches filtered\n", (unsigned long long)reads,
+         (unsigned)logicData.Races(), decoded ? logicData.Races() * 1000.0 / decoded : 0.0, (unsigned)logicData.Glitches());
+  return corrupted ? 1 : 0;
+}
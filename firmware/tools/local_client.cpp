@@ -0,0 +1,137 @@
+// Client for the local control endpoint (lib/LocalEndpoint/LocalEndpoint.h)
+//
+// Sends one frame, then prints what the desk streams back:
+//   <ms> H <height> <direction>
+//   <ms> E <event>
+// and the latency from sending to the first height frame showing motion.
+//
+// Build (from firmware/):
+//   g++ -O2 -Ilib/LocalEndpoint -o local_client tools/local_client.cpp
+//
+// Usage: local_client [--host addr] [--port N] [--watch s] <cmd|set|queue> <payload>
+//   e.g. `local_client set 110` or `local_client queue "7:110;wait 5;90"`;
+//   try it against tools/desk_sim on 127.0.0.1.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+
+#define LOCAL_PORT 2323
+#define LOCAL_MAX_PAYLOAD 62
+
+static double now_ms() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+static int open_socket(const char * host, const char * port) {
+  struct addrinfo hints = {}, * res;
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host, port, &hints, &res)) {
+    fprintf(stderr, "cannot resolve %s\n", host);
+    return -1;
+  }
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0 || connect(fd, res->ai_addr, res->ai_addrlen)) {
+    perror("connect");
+    freeaddrinfo(res);
+    return -1;
+  }
+  freeaddrinfo(res);
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+  return fd;
+}
+
+int main(int argc, char ** argv) {
+  const char * host = "127.0.0.1";
+  char port[8];
+  snprintf(port, sizeof(port), "%d", LOCAL_PORT);
+  double watch_s = 10;
+  const char * kind = nullptr;
+  const char * payload = nullptr;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--host") && i + 1 < argc) {
+      host = argv[++i];
+    } else if (!strcmp(argv[i], "--port") && i + 1 < argc) {
+      snprintf(port, sizeof(port), "%s", argv[++i]);
+    } else if (!strcmp(argv[i], "--watch") && i + 1 < argc) {
+      watch_s = atof(argv[++i]);
+    } else if (!kind) {
+      kind = argv[i];
+    } else {
+      payload = argv[i];
+    }
+  }
+
+  char type = !kind ? 0 : !strcmp(kind, "cmd") ? 'C' : !strcmp(kind, "set") ? 'S' : !strcmp(kind, "queue") ? 'Q' : 0;
+  if (!type || !payload || strlen(payload) > LOCAL_MAX_PAYLOAD) {
+    fprintf(stderr, "usage: %s [--host addr] [--port N] [--watch s] <cmd|set|queue> <payload>\n", argv[0]);
+    return 2;
+  }
+
+  int fd = open_socket(host, port);
+  if (fd < 0) return 1;
+
+  // the desk greets with its height; wait for it so the clock starts at the command
+  uint8_t buf[2 + LOCAL_MAX_PAYLOAD + 1];
+  size_t used = 0;
+  int start_height = -1;
+  double sent = 0, t0 = now_ms(), moving_ms = -1;
+  bool command_sent = false;
+
+  while (now_ms() - t0 < watch_s * 1000) {
+    if (!command_sent && (start_height >= 0 || now_ms() - t0 > 500)) {
+      uint8_t frame[2 + LOCAL_MAX_PAYLOAD];
+      frame[0] = strlen(payload);
+      frame[1] = type;
+      memcpy(frame + 2, payload, frame[0]);
+      sent = now_ms();
+      if (write(fd, frame, 2 + frame[0]) != 2 + frame[0]) {
+        perror("write");
+        return 1;
+      }
+      command_sent = true;
+    }
+
+    struct pollfd p = {fd, POLLIN, 0};
+    if (poll(&p, 1, 50) <= 0) continue;
+    ssize_t n = read(fd, buf + used, sizeof(buf) - 1 - used);
+    if (n <= 0) {
+      fprintf(stderr, "connection closed\n");
+      break;
+    }
+    used += n;
+
+    while (used >= 2 && used >= 2u + buf[0]) {
+      uint8_t len = buf[0];
+      double t = command_sent ? now_ms() - sent : 0;
+      if (buf[1] == 'H' && len >= 2) {
+        int height = buf[2], direction = (int8_t)buf[3];
+        printf("%8.1f H %d %d\n", t, height, direction);
+        if (start_height < 0) start_height = height;
+        if (command_sent && moving_ms < 0 && direction) moving_ms = t;
+      } else if (buf[1] == 'E') {
+        printf("%8.1f E %.*s\n", t, len, (char *)buf + 2);
+      }
+      memmove(buf, buf + 2 + len, used - 2 - len);
+      used -= 2 + len;
+    }
+  }
+
+  if (moving_ms >= 0)
+    printf("latency: %.1fms from command to reported motion\n", moving_ms);
+  close(fd);
+  return 0;
+}
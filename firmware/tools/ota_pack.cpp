@@ -0,0 +1,226 @@
+// Packs a firmware image for OTA and optionally pushes it to a desk.
+//
+// The image is gzipped; the ESP8266 Updater takes gzip images as they are
+// and the bootloader unpacks them while copying them into place, so a
+// compressed update moves about a third less over the air. The push speaks
+// the espota protocol (no password): a UDP invitation to the desk, which then
+// connects back and takes the image in chunks, acknowledging each.
+//
+// Build (from firmware/):
+//   g++ -O2 -Itools/host -o ota_pack tools/ota_pack.cpp tools/host/MD5Builder.cpp -lz
+//
+// Usage: ota_pack [--raw] [--out file] [--push host] [--port N] <firmware.bin>
+//   Writes <firmware.bin>.gz (or --out), --raw skips the compression.
+//   --push sends the packed image to the desk at host (UDP port 8266, or
+//   --port), e.g. `ota_pack .pio/build/d1_mini/firmware.bin --push 192.168.1.1`;
+//   try it against `desk_sim --ota-port 8266` on 127.0.0.1.
+
+#include <MD5Builder.h>
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <zlib.h>
+
+#include <string>
+#include <vector>
+
+#define OTA_PORT 8266
+#define OTA_CHUNK 1460
+#define OTA_TIMEOUT_MS 10000
+#define PROGRESS_STEPS 10
+
+static double now_ms() {
+  struct timespec t;
+  clock_gettime(CLOCK_MONOTONIC, &t);
+  return t.tv_sec * 1e3 + t.tv_nsec / 1e6;
+}
+
+static bool read_file(const char * path, std::vector<uint8_t> & out) {
+  FILE * f = fopen(path, "rb");
+  if (!f) return false;
+  uint8_t buf[4096];
+  size_t n;
+  while ((n = fread(buf, 1, sizeof(buf), f)) > 0)
+    out.insert(out.end(), buf, buf + n);
+  fclose(f);
+  return true;
+}
+
+static bool gzip(const std::vector<uint8_t> & in, std::vector<uint8_t> & out) {
+  z_stream z = {};
+  // windowBits 15 + 16: gzip framing, as `gzip -9` writes it
+  if (deflateInit2(&z, 9, Z_DEFLATED, 15 + 16, 9, Z_DEFAULT_STRATEGY) != Z_OK)
+    return false;
+  out.resize(deflateBound(&z, in.size()));
+  z.next_in = (Bytef *)in.data();
+  z.avail_in = in.size();
+  z.next_out = out.data();
+  z.avail_out = out.size();
+  int r = deflate(&z, Z_FINISH);
+  out.resize(z.total_out);
+  deflateEnd(&z);
+  return r == Z_STREAM_END;
+}
+
+static void md5_of(const std::vector<uint8_t> & data, char * out) {
+  MD5Builder md5;
+  md5.begin();
+  md5.add(data.data(), data.size());
+  md5.calculate();
+  md5.getChars(out);
+}
+
+static bool recv_reply(int fd, char * buf, size_t size, int timeout_ms) {
+  struct pollfd p = {fd, POLLIN, 0};
+  if (poll(&p, 1, timeout_ms) != 1) return false;
+  ssize_t n = recv(fd, buf, size - 1, 0);
+  if (n <= 0) return false;
+  buf[n] = 0;
+  return true;
+}
+
+static int push(const char * host, uint16_t port, const std::vector<uint8_t> & image) {
+  struct addrinfo hints = {}, * res;
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_DGRAM;
+  char service[8];
+  snprintf(service, sizeof(service), "%u", port);
+  if (getaddrinfo(host, service, &hints, &res)) {
+    fprintf(stderr, "unknown host %s\n", host);
+    return 1;
+  }
+
+  // the desk connects back to this port for the image
+  int server = socket(AF_INET, SOCK_STREAM, 0);
+  struct sockaddr_in local = {};
+  local.sin_family = AF_INET;
+  socklen_t local_len = sizeof(local);
+  if (server < 0 || bind(server, (struct sockaddr *)&local, sizeof(local)) || listen(server, 1) ||
+      getsockname(server, (struct sockaddr *)&local, &local_len)) {
+    perror("listen");
+    return 1;
+  }
+
+  char md5[33], invite[80], reply[64];
+  md5_of(image, md5);
+  int len = snprintf(invite, sizeof(invite), "0 %u %u %s\n", ntohs(local.sin_port), (unsigned)image.size(), md5);
+
+  int udp = socket(AF_INET, SOCK_DGRAM, 0);
+  bool invited = false;
+  for (int attempt = 0; attempt < 10 && !invited; attempt++) {
+    sendto(udp, invite, len, 0, res->ai_addr, res->ai_addrlen);
+    invited = recv_reply(udp, reply, sizeof(reply), 1000);
+  }
+  freeaddrinfo(res);
+  close(udp);
+  if (!invited) {
+    fprintf(stderr, "no answer from %s:%u\n", host, port);
+    return 1;
+  }
+  if (strncmp(reply, "OK", 2)) {
+    fprintf(stderr, "the desk answered '%s'; password protected updates need espota.py\n", reply);
+    return 1;
+  }
+
+  struct pollfd p = {server, POLLIN, 0};
+  int fd = poll(&p, 1, OTA_TIMEOUT_MS) == 1 ? accept(server, nullptr, nullptr) : -1;
+  close(server);
+  if (fd < 0) {
+    fprintf(stderr, "the desk did not connect\n");
+    return 1;
+  }
+
+  double start = now_ms();
+  int step = -1;
+  for (size_t sent = 0; sent < image.size(); ) {
+    size_t n = image.size() - sent < OTA_CHUNK ? image.size() - sent : OTA_CHUNK;
+    if (send(fd, image.data() + sent, n, MSG_NOSIGNAL) != (ssize_t)n || !recv_reply(fd, reply, sizeof(reply), OTA_TIMEOUT_MS)) {
+      fprintf(stderr, "transfer failed after %u bytes\n", (unsigned)sent);
+      close(fd);
+      return 1;
+    }
+    sent += n;
+    int s = sent * PROGRESS_STEPS / image.size();
+    if (s != step) {
+      step = s;
+      printf("%3d%%\n", s * 100 / PROGRESS_STEPS);
+    }
+  }
+
+  // the desk acknowledges the last chunk, then checks the image and says OK
+  bool ok = strstr(reply, "OK") || (recv_reply(fd, reply, sizeof(reply), OTA_TIMEOUT_MS) && strstr(reply, "OK"));
+  close(fd);
+  double ms = now_ms() - start;
+  if (!ok) {
+    fprintf(stderr, "the desk rejected the image\n");
+    return 1;
+  }
+  printf("sent %u bytes in %.0f ms (%.1f kB/s)\n", (unsigned)image.size(), ms, image.size() / ms);
+  return 0;
+}
+
+int main(int argc, char ** argv) {
+  const char * in = nullptr, * out = nullptr, * host = nullptr;
+  uint16_t port = OTA_PORT;
+  bool raw = false;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "--raw")) {
+      raw = true;
+    } else if (!strcmp(argv[i], "--out") && i + 1 < argc) {
+      out = argv[++i];
+    } else if (!strcmp(argv[i], "--push") && i + 1 < argc) {
+      host = argv[++i];
+    } else if (!strcmp(argv[i], "--port") && i + 1 < argc) {
+      port = atoi(argv[++i]);
+    } else if (!in && argv[i][0] != '-') {
+      in = argv[i];
+    } else {
+      in = nullptr;
+      break;
+    }
+  }
+  if (!in) {
+    fprintf(stderr, "usage: %s [--raw] [--out file] [--push host] [--port N] <firmware.bin>\n", argv[0]);
+    return 2;
+  }
+
+  std::vector<uint8_t> image, packed;
+  if (!read_file(in, image)) {
+    perror(in);
+    return 1;
+  }
+  if (image.empty() || image[0] != 0xe9) {
+    fprintf(stderr, "%s is not an ESP8266 firmware image\n", in);
+    return 1;
+  }
+
+  if (raw) {
+    packed = image;
+  } else {
+    if (!gzip(image, packed)) {
+      fprintf(stderr, "compression failed\n");
+      return 1;
+    }
+    std::string path = out ? out : std::string(in) + ".gz";
+    FILE * f = fopen(path.c_str(), "wb");
+    if (!f || fwrite(packed.data(), 1, packed.size(), f) != packed.size()) {
+      perror(path.c_str());
+      return 1;
+    }
+    fclose(f);
+    printf("%s: %u -> %u bytes (%u%%)\n", path.c_str(), (unsigned)image.size(), (unsigned)packed.size(),
+           (unsigned)(packed.size() * 100 / image.size()));
+  }
+
+  return host ? push(host, port, packed) : 0;
+}
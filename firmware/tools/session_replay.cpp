@@ -0,0 +1,203 @@
+// Replays a recorded firmware session (see lib/SessionRecorder/SessionRecorder.h)
+// through the real firmware under a virtual clock, much faster than real time.
+//
+// Every pin write and MQTT publish of the firmware is written to a trace with
+// its virtual timestamp. With --golden the trace is compared against a trace
+// from a known-good build and the first difference is reported.
+//
+// Build (from firmware/):
+//   g++ -O2 -Itools/host -Itools/host/config -Ilib/LogicData -Ilib/Logging
+//       -Ilib/ProtocolLearner -Ilib/EdgeCapture -Ilib/SessionRecorder -Ilib/MotionSupervisor
+//       -Ilib/DeskState -Ilib/FlashLog -Ilib/CommandCoalescer -Ilib/CommandQueue -Ilib/Backoff
+//       -Ilib/MotionModel -Ilib/FastPin -Ilib/DutyCycle -Ilib/PublishPolicy -Ilib/HeightHistory
+//       -o session_replay tools/session_replay.cpp src/main.cpp lib/*/*.cpp tools/host/*.cpp
+//
+// Usage: session_replay [-v] [--loop-us N] [--tail-ms N] [--out trace] [--golden trace] <session file>
+//   A session file is the concatenation of the frames published to
+//   <MQTT_TOPIC>session, e.g. `mosquitto_sub -t home/table/session >> desk.ses`.
+
+#include <Arduino.h>
+#include <PubSubClient.h>
+#include <SessionRecorder.h>
+#include <pins.h>
+#include "frames.h"
+#include "MappedFile.h"
+
+#include <vector>
+
+// firmware entry points (src/main.cpp)
+void setup();
+void loop();
+
+static const uint8_t replay_buttons[] = {BTN_UP, BTN_DOWN};
+
+struct ReplayStats {
+  uint64_t edges = 0;
+  uint64_t buttons = 0;
+  uint64_t messages = 0;
+  uint64_t gaps = 0;
+  uint64_t loops = 0;
+};
+
+static ReplayStats stats;
+static uint32_t loop_us = 250;
+
+// Run the firmware loop until the virtual clock reaches t
+static void run_until(uint64_t t) {
+  while (host_us < t) {
+    uint64_t next = host_us + loop_us;
+    loop();
+    stats.loops++;
+    if (host_us < next) host_advance((next < t ? next : t) - host_us);
+  }
+}
+
+static bool replay(const std::vector<uint8_t> & stream) {
+  uint64_t t = host_us;
+  size_t off = 0;
+
+  while (off < stream.size()) {
+    SessionRecord r;
+    size_t n = SessionRecorder::Parse(stream.data() + off, stream.size() - off, r);
+    if (!n) {
+      fprintf(stderr, "session: cannot parse record at offset %zu\n", off);
+      return false;
+    }
+    off += n;
+
+    t += r.dt;
+    run_until(t);
+
+    switch (r.tag) {
+      case SESSION_EDGE_LOW:
+      case SESSION_EDGE_HIGH:
+        stats.edges++;
+        host_pin_input(LOGICDATA_RX, r.tag == SESSION_EDGE_HIGH);
+        break;
+
+      case SESSION_BUTTON:
+        if ((r.value >> 1) < sizeof(replay_buttons)) {
+          stats.buttons++;
+          host_pin_input(replay_buttons[r.value >> 1], r.value & 1);
+        }
+        break;
+
+      case SESSION_MQTT: {
+        stats.messages++;
+        std::string topic(r.topic, r.topic_len);
+        host_mqtt_deliver(topic.c_str(), r.payload, r.payload_len);
+        break;
+      }
+
+      case SESSION_GAP:
+        stats.gaps++;
+        break;
+    }
+  }
+  return true;
+}
+
+// Compare two traces line by line; returns true if equal
+static bool compare(const char * trace, size_t len, const char * golden_path) {
+  MappedFile golden;
+  if (!golden.open(golden_path)) return false;
+
+  const char * a = trace;
+  const char * b = (const char *)golden.data;
+  const char * a_end = trace + len;
+  const char * b_end = b + golden.size;
+  unsigned line = 1;
+
+  while (a < a_end || b < b_end) {
+    const char * a_nl = (const char *)memchr(a, '\n', a_end - a);
+    const char * b_nl = (const char *)memchr(b, '\n', b_end - b);
+    size_t a_len = (a_nl ? a_nl : a_end) - a;
+    size_t b_len = (b_nl ? b_nl : b_end) - b;
+
+    if (a_len != b_len || memcmp(a, b, a_len)) {
+      fprintf(stderr, "trace differs from %s at line %u\n", golden_path, line);
+      fprintf(stderr, "  golden: %.*s\n", (int)b_len, b < b_end ? b : "<eof>");
+      fprintf(stderr, "  replay: %.*s\n", (int)a_len, a < a_end ? a : "<eof>");
+      return false;
+    }
+
+    a = a_nl ? a_nl + 1 : a_end;
+    b = b_nl ? b_nl + 1 : b_end;
+    line++;
+  }
+  return true;
+}
+
+int main(int argc, char ** argv) {
+  const char * session_path = nullptr;
+  const char * out_path = nullptr;
+  const char * golden_path = nullptr;
+  uint32_t tail_ms = 5000;
+
+  for (int i = 1; i < argc; i++) {
+    if (!strcmp(argv[i], "-v")) {
+      host_serial_echo = true;
+    } else if (!strcmp(argv[i], "--loop-us") && i + 1 < argc) {
+      loop_us = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--tail-ms") && i + 1 < argc) {
+      tail_ms = atoi(argv[++i]);
+    } else if (!strcmp(argv[i], "--out") && i + 1 < argc) {
+      out_path = argv[++i];
+    } else if (!strcmp(argv[i], "--golden") && i + 1 < argc) {
+      golden_path = argv[++i];
+    } else {
+      session_path = argv[i];
+    }
+  }
+
+  if (!session_path || !loop_us) {
+    fprintf(stderr, "usage: %s [-v] [--loop-us N] [--tail-ms N] [--out trace] [--golden trace] <session file>\n", argv[0]);
+    return 2;
+  }
+
+  MappedFile f;
+  if (!f.open(session_path)) return 2;
+
+  FrameStats frames;
+  std::vector<uint8_t> stream;
+  for_each_frame(f.data, f.size, SESSION_FRAME_MAGIC, frames,
+    [&](const uint8_t * data, size_t n, bool) {
+      stream.insert(stream.end(), data, data + n);
+    });
+  if (frames.lost || frames.bad) {
+    fprintf(stderr, "session: %llu frames lost, %llu bad bytes; replay will not be exact\n",
+            (unsigned long long)frames.lost, (unsigned long long)frames.bad);
+  }
+
+  char * trace = nullptr;
+  size_t trace_len = 0;
+  host_trace = open_memstream(&trace, &trace_len);
+
+  setup();
+  bool ok = replay(stream);
+  run_until(host_us + uint64_t(tail_ms) * 1000);
+
+  fclose(host_trace);
+  host_trace = nullptr;
+
+  if (out_path) {
+    FILE * out = fopen(out_path, "w");
+    if (!out) {
+      perror(out_path);
+      return 2;
+    }
+    fwrite(trace, 1, trace_len, out);
+    fclose(out);
+  } else if (!golden_path) {
+    fwrite(trace, 1, trace_len, stdout);
+  }
+
+  fprintf(stderr, "replayed %.3fs in %llu loops: %llu edges, %llu button changes, %llu messages, %llu gaps\n",
+          host_us / 1e6, (unsigned long long)stats.loops, (unsigned long long)stats.edges,
+          (unsigned long long)stats.buttons, (unsigned long long)stats.messages,
+          (unsigned long long)stats.gaps);
+
+  if (ok && golden_path) ok = compare(trace, trace_len, golden_path);
+  free(trace);
+  return ok ? 0 : 1;
+}